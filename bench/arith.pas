@@ -0,0 +1,65 @@
+VAR
+  x, y, z, q, r, i, j, sum;
+
+PROCEDURE multiply;
+VAR a, b;
+BEGIN
+  a := x;
+  b := y;
+  z := 0;
+  WHILE b > 0 DO BEGIN
+    IF ODD b THEN z := z + a;
+    a := 2 * a;
+    b := b / 2;
+  END
+END;
+
+PROCEDURE divide;
+VAR w;
+BEGIN
+  r := x;
+  q := 0;
+  w := y;
+  WHILE w <= r DO w := 2 * w;
+  WHILE w > y DO BEGIN
+    q := 2 * q;
+    w := w / 2;
+    IF w <= r THEN BEGIN
+      r := r - w;
+      q := q + 1
+    END
+  END
+END;
+
+PROCEDURE gcd;
+VAR f, g;
+BEGIN
+  f := x;
+  g := y;
+  WHILE f # g DO BEGIN
+    IF f < g THEN g := g - f;
+    IF g < f THEN f := f - g;
+  END;
+  z := f
+END;
+
+BEGIN
+  sum := 0;
+  i := 1;
+  WHILE i <= 4000 DO BEGIN
+    j := 1;
+    WHILE j <= 300 DO BEGIN
+      x := i;
+      y := j;
+      CALL multiply;
+      sum := sum + z;
+      CALL divide;
+      sum := sum + q + r;
+      CALL gcd;
+      sum := sum + z;
+      j := j + 1
+    END;
+    i := i + 1
+  END;
+  write sum
+END.
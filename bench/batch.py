@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+#
+#  batch.py - throughput of `pl0 --batch` against parallel processes
+#
+#  usage: batch.py [--pl0 PATH] [--programs N] [--jobs N]
+#                  [-- pl0 options...]
+#
+#  Copies the samples that need no input into a temporary directory until
+#  it holds N programs, then runs them with `pl0 --batch -j JOBS` and as one
+#  `pl0` process per program through `xargs -P JOBS`. Prints programs per
+#  second for both.
+#
+
+import argparse
+import glob
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+# Samples that fail on purpose
+SKIP = {'divide-by-zero.pas'}
+
+
+def measure(command, cwd):
+    start = time.perf_counter()
+    subprocess.run(command, cwd=cwd, stdin=subprocess.DEVNULL,
+                   stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL,
+                   check=True)
+    return time.perf_counter() - start
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--pl0', default=os.path.join(ROOT, 'pl0'))
+    parser.add_argument('--programs', type=int, default=1000)
+    parser.add_argument('--jobs', type=int, default=os.cpu_count())
+    parser.add_argument('args', nargs='*', help='options passed to pl0')
+    opts = parser.parse_args()
+    pl0 = os.path.abspath(opts.pl0)
+
+    samples = [path for path in sorted(glob.glob(
+        os.path.join(ROOT, 'samples/*.pas')))
+        if os.path.basename(path) not in SKIP]
+
+    with tempfile.TemporaryDirectory() as tmp:
+        for i in range(opts.programs):
+            sample = samples[i % len(samples)]
+            shutil.copy(sample, os.path.join(
+                tmp, f'{i:06}-{os.path.basename(sample)}'))
+
+        jobs = str(opts.jobs)
+        cases = [
+            (f'pl0 --batch -j {jobs}',
+             [pl0, '--batch', '-j', jobs] + opts.args + ['.']),
+            (f'xargs -P {jobs} pl0',
+             ['sh', '-c', f'ls *.pas | xargs -P {jobs} -n 1 {pl0} '
+              + ' '.join(opts.args)]),
+        ]
+
+        print(f'{"":<24} {"seconds":>10} {"programs/s":>12}')
+        for name, command in cases:
+            seconds = measure(command, tmp)
+            print(f'{name:<24} {seconds:>10.3f} '
+                  f'{opts.programs / seconds:>12.1f}')
+
+
+if __name__ == '__main__':
+    sys.exit(main())
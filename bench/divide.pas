@@ -0,0 +1,12 @@
+VAR i, d, sum;
+
+BEGIN
+  sum := 0;
+  i := 0;
+  WHILE i < 50000000 DO BEGIN
+    d := i / 7 + 1;
+    sum := sum + 1000000007 / d + i / d;
+    i := i + 1
+  END;
+  write sum
+END.
@@ -0,0 +1,32 @@
+CONST
+  n = 4096, rounds = 50000;
+
+VAR
+  a[4096], b[4096], len, i, r, s;
+
+PROCEDURE dot;
+VAR k;
+BEGIN
+  s := 0;
+  k := 0;
+  WHILE k < len DO BEGIN
+    s := s + a[k] * b[k];
+    k := k + 1
+  END
+END;
+
+BEGIN
+  i := 0;
+  WHILE i < n DO BEGIN
+    a[i] := i;
+    b[i] := n - i;
+    i := i + 1
+  END;
+  len := n;
+  r := 0;
+  WHILE r < rounds DO BEGIN
+    CALL dot;
+    r := r + 1
+  END;
+  write s
+END.
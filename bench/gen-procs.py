@@ -0,0 +1,36 @@
+#!/usr/bin/env python3
+#
+#  gen-procs.py - generate a PL/0 program with many mostly-cold procedures
+#
+#  usage: gen-procs.py [procedures] [called]
+#
+
+import sys
+
+procs = int(sys.argv[1]) if len(sys.argv) > 1 else 2000
+called = int(sys.argv[2]) if len(sys.argv) > 2 else 1
+
+print('VAR x, y, r;')
+print()
+
+for i in range(procs):
+    print(f'PROCEDURE p{i};')
+    print('VAR a, b;')
+    print('BEGIN')
+    print(f'  a := x + {i};')
+    print('  b := 0;')
+    print('  WHILE a > 0 DO BEGIN')
+    print(f'    IF ODD a THEN b := b + a * {i % 7 + 1};')
+    print('    a := a / 2')
+    print('  END;')
+    print('  r := b - y')
+    print('END;')
+    print()
+
+print('BEGIN')
+print('  x := 10;')
+print('  y := 1;')
+for i in range(called):
+    print(f'  CALL p{i * procs // called};')
+    print('  ! r;')
+print('END.')
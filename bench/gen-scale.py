@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+#
+#  gen-scale.py - generate a PL/0 program of about the given number of lines
+#
+#  usage: gen-scale.py [lines]
+#
+#  The program is a sequence of procedures, each with its own locals and a
+#  nested procedure that updates them, so every line goes through parsing,
+#  name resolution and free-variable propagation. Only the last procedure
+#  is called; the rest is there to be compiled.
+#
+
+import sys
+
+UNIT = 18  # lines per procedure
+
+
+def generate(lines, out):
+    procs = max(1, (lines - 8) // UNIT)
+
+    out.write('CONST step = 3;\n')
+    out.write('VAR x, r;\n')
+    out.write('\n')
+    for i in range(procs):
+        out.write(f'PROCEDURE p{i};\n'
+                  f'VAR a{i}, b{i};\n'
+                  f'  PROCEDURE q{i};\n'
+                  f'  BEGIN\n'
+                  f'    b{i} := b{i} + a{i} * {i % 7 + 1};\n'
+                  f'    a{i} := a{i} - step\n'
+                  f'  END;\n'
+                  f'BEGIN\n'
+                  f'  a{i} := x + {i};\n'
+                  f'  b{i} := 0;\n'
+                  f'  WHILE a{i} > 0 DO BEGIN\n'
+                  f'    IF ODD a{i} THEN CALL q{i};\n'
+                  f'    a{i} := a{i} / 2\n'
+                  f'  END;\n'
+                  f'  r := b{i}')
+        if i > 0:
+            out.write(f';\n  IF r < 0 THEN CALL p{i - 1}\n')
+        else:
+            out.write('\n')
+        out.write('END;\n'
+                  '\n')
+
+    out.write('BEGIN\n'
+              '  x := 10;\n'
+              f'  CALL p{procs - 1};\n'
+              '  ! r\n'
+              'END.\n')
+
+
+if __name__ == '__main__':
+    generate(int(sys.argv[1]) if len(sys.argv) > 1 else 1000, sys.stdout)
@@ -0,0 +1,30 @@
+CONST
+  n = 65536, buckets = 256, rounds = 2000;
+
+VAR
+  a[65536], h[256], i, r, x;
+
+BEGIN
+  i := 0;
+  WHILE i < n DO BEGIN
+    x := i * 37 + i / 5;
+    a[i] := x - x / buckets * buckets;
+    i := i + 1
+  END;
+  r := 0;
+  WHILE r < rounds DO BEGIN
+    i := 0;
+    WHILE i < n DO BEGIN
+      h[a[i]] := h[a[i]] + 1;
+      i := i + 1
+    END;
+    r := r + 1
+  END;
+  x := 0;
+  i := 0;
+  WHILE i < buckets DO BEGIN
+    x := x + h[i] * i;
+    i := i + 1
+  END;
+  write x
+END.
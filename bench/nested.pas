@@ -0,0 +1,44 @@
+VAR n, r, i;
+
+PROCEDURE outer;
+  VAR a, b;
+
+  PROCEDURE middle;
+    VAR c;
+
+    PROCEDURE fib;
+      VAR m, r1;
+    BEGIN
+      m := n;
+      IF m < 2 THEN r := m + a - b + c;
+      IF m >= 2 THEN BEGIN
+        n := m - 1;
+        CALL fib;
+        r1 := r;
+        n := m - 2;
+        CALL fib;
+        r := r1 + r - c
+      END
+    END;
+
+  BEGIN
+    c := 1;
+    CALL fib
+  END;
+
+BEGIN
+  a := 2;
+  b := 2;
+  CALL middle
+END;
+
+BEGIN
+  i := 0;
+  WHILE i < 36 DO
+  BEGIN
+    n := i;
+    CALL outer;
+    write r;
+    i := i + 1
+  END
+END.
@@ -0,0 +1,23 @@
+CONST
+  n = 65536, rounds = 2000;
+
+VAR
+  a[65536], i, r;
+
+BEGIN
+  i := 0;
+  WHILE i < n DO BEGIN
+    a[i] := i - i / 7 * 7;
+    i := i + 1
+  END;
+  r := 0;
+  WHILE r < rounds DO BEGIN
+    i := 1;
+    WHILE i < n DO BEGIN
+      a[i] := a[i] + a[i - 1];
+      i := i + 1
+    END;
+    r := r + 1
+  END;
+  write a[n - 1]
+END.
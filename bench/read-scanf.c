@@ -0,0 +1,20 @@
+/*
+ *  read-scanf.c - scanf baseline for bench/read.pas
+ */
+
+#include <stdio.h>
+
+int main(void) {
+  int n, i, x, sum = 0;
+  if (scanf("%d", &n) != 1) {
+    return 1;
+  }
+  for (i = 0; i < n; i++) {
+    if (scanf("%d", &x) != 1) {
+      return 1;
+    }
+    sum += x;
+  }
+  printf("%d\n", sum);
+  return 0;
+}
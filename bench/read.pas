@@ -0,0 +1,13 @@
+VAR n, i, x, sum;
+
+BEGIN
+  ? n;
+  i := 0;
+  sum := 0;
+  WHILE i < n DO BEGIN
+    ? x;
+    sum := sum + x;
+    i := i + 1
+  END;
+  ! sum
+END.
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+#
+#  run.py - benchmark driver for the PL/0 workloads
+#
+#  usage: run.py [--pl0 PATH] [--runs N] [--json FILE] [--baseline FILE]
+#                [--only NAME[,NAME...]] [-- pl0 options...]
+#
+#  Each workload runs N times with `--trace`, and the trace events are
+#  split into parse, compile (lower, symbols, irgen, bytecode, optimize,
+#  codegen) and execute time (without the compilation nested in it). Only
+#  the main thread counts, so `-j N` compiles are measured by wall time
+#  (split + compile) rather than summed over threads. The median and
+#  percentiles are printed in milliseconds and optionally written as JSON;
+#  a previous JSON file given with --baseline is compared by median.
+#
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+WORKLOADS = [
+    ('fib', 'samples/fib.pas'),           # recursion
+    ('arith', 'bench/arith.pas'),         # multiply/divide/gcd loops
+    ('write', 'bench/write.pas'),         # output heavy
+    ('nested', 'bench/nested.pas'),       # deep nesting, outer variables
+    ('divide', 'bench/divide.pas'),       # zero divide checks
+    ('dot', 'bench/dot.pas'),             # array loop with a variable bound
+    ('prefix', 'bench/prefix.pas'),       # array loop-carried dependence
+    ('histogram', 'bench/histogram.pas'), # data-dependent array indices
+]
+
+COMPILE_PHASES = {'lower', 'symbols', 'ranges', 'memo', 'irgen', 'bytecode', 'optimize',
+                  'codegen', 'split', 'compile'}
+PHASES = ['parse', 'compile', 'execute', 'total']
+
+
+def percentile(values, p):
+    values = sorted(values)
+    k = (len(values) - 1) * p / 100
+    i = int(k)
+    j = min(i + 1, len(values) - 1)
+    return values[i] + (values[j] - values[i]) * (k - i)
+
+
+def run_once(pl0, args, path):
+    with tempfile.NamedTemporaryFile(suffix='.json') as trace:
+        start = time.perf_counter()
+        subprocess.run([pl0, '--trace', trace.name] + args + [path],
+                       stdin=subprocess.DEVNULL, stdout=subprocess.DEVNULL,
+                       check=True)
+        total = (time.perf_counter() - start) * 1e3
+        events = json.load(trace)['traceEvents']
+
+    times = {'parse': 0.0, 'compile': 0.0, 'execute': 0.0, 'total': total}
+    phases = [e for e in events if e['ph'] == 'X' and e['tid'] == 1]
+    for e in phases:
+        if e['name'] == 'parse':
+            times['parse'] += e['dur'] / 1e3
+        elif e['name'] in COMPILE_PHASES:
+            times['compile'] += e['dur'] / 1e3
+        elif e['name'] == 'execute':
+            # Lazy and tiered compilation happen while the program runs
+            nested = sum(c['dur'] for c in phases
+                         if c['name'] in COMPILE_PHASES and
+                         e['ts'] <= c['ts'] < e['ts'] + e['dur'])
+            times['execute'] += (e['dur'] - nested) / 1e3
+    return times
+
+
+def summarize(samples):
+    return {
+        'median': percentile(samples, 50),
+        'p10': percentile(samples, 10),
+        'p90': percentile(samples, 90),
+        'min': min(samples),
+        'max': max(samples),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--pl0', default=os.path.join(ROOT, 'pl0'))
+    parser.add_argument('--runs', type=int, default=10)
+    parser.add_argument('--json')
+    parser.add_argument('--baseline')
+    parser.add_argument('--only')
+    parser.add_argument('args', nargs='*', help='options passed to pl0')
+    opts = parser.parse_args()
+
+    workloads = WORKLOADS
+    if opts.only:
+        names = opts.only.split(',')
+        workloads = [w for w in WORKLOADS if w[0] in names]
+
+    baseline = None
+    if opts.baseline:
+        with open(opts.baseline) as f:
+            baseline = json.load(f)['workloads']
+
+    header = f'{"workload":<10} {"phase":<8} {"median":>10} {"p10":>10} ' \
+             f'{"p90":>10}'
+    if baseline:
+        header += f' {"baseline":>10} {"change":>8}'
+    print(header)
+
+    results = {}
+    for name, path in workloads:
+        samples = {phase: [] for phase in PHASES}
+        for _ in range(opts.runs):
+            times = run_once(opts.pl0, opts.args, os.path.join(ROOT, path))
+            for phase in PHASES:
+                samples[phase].append(times[phase])
+
+        results[name] = {phase: summarize(samples[phase]) for phase in PHASES}
+        for phase in PHASES:
+            s = results[name][phase]
+            line = f'{name:<10} {phase:<8} {s["median"]:>10.3f} ' \
+                   f'{s["p10"]:>10.3f} {s["p90"]:>10.3f}'
+            if baseline and name in baseline:
+                base = baseline[name][phase]['median']
+                change = (s['median'] / base - 1) * 100 if base else 0.0
+                line += f' {base:>10.3f} {change:>+7.1f}%'
+            print(line)
+
+    if opts.json:
+        with open(opts.json, 'w') as f:
+            json.dump({'pl0': opts.pl0, 'args': opts.args, 'runs': opts.runs,
+                       'unit': 'ms', 'workloads': results}, f, indent=2)
+            f.write('\n')
+
+
+if __name__ == '__main__':
+    sys.exit(main())
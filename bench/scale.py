@@ -0,0 +1,85 @@
+#!/usr/bin/env python3
+#
+#  scale.py - front end time and memory against program size
+#
+#  usage: scale.py [--pl0 PATH] [--max LINES] [-- pl0 options...]
+#
+#  Generates programs of 1K, 10K, ... lines up to --max (default 1M; 10M
+#  needs several GB) with gen-scale.py, runs each once with `--trace` and
+#  prints the phase times, the time per line and the peak RSS after each
+#  phase. Runs use `--mode interp` unless options are given, so the
+#  numbers stay about the front end. Per-line time that grows with the
+#  size shows a superlinear phase.
+#
+
+import argparse
+import importlib.util
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+PHASES = ['read', 'parse', 'lower', 'symbols']
+
+
+def load_generator():
+    path = os.path.join(ROOT, 'bench', 'gen-scale.py')
+    spec = importlib.util.spec_from_file_location('gen_scale', path)
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    return module.generate
+
+
+def run_once(pl0, args, path):
+    with tempfile.NamedTemporaryFile(suffix='.json') as trace:
+        proc = subprocess.Popen([pl0, '--trace', trace.name] + args + [path],
+                                stdin=subprocess.DEVNULL,
+                                stdout=subprocess.DEVNULL)
+        _, status, usage = os.wait4(proc.pid, 0)
+        proc.returncode = os.waitstatus_to_exitcode(status)
+        if proc.returncode != 0:
+            raise RuntimeError(f'pl0 exited with {proc.returncode}')
+        events = json.load(trace)['traceEvents']
+
+    times = {}
+    for e in events:
+        if e['ph'] == 'X' and e['tid'] == 1 and e['name'] in PHASES:
+            times[e['name']] = (e['dur'] / 1e3,
+                                e['args']['peak_rss_kib'] / 1024)
+    return times, usage.ru_maxrss / 1024
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--pl0', default=os.path.join(ROOT, 'pl0'))
+    parser.add_argument('--max', type=int, default=1000000)
+    parser.add_argument('args', nargs='*', help='options passed to pl0')
+    opts = parser.parse_args()
+    args = opts.args or ['--mode', 'interp']
+    generate = load_generator()
+
+    print(f'{"lines":>10} {"MB":>7} {"phase":<8} {"ms":>10} {"us/line":>8} '
+          f'{"rss MB":>8}')
+    lines = 1000
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, 'scale.pas')
+        while lines <= opts.max:
+            with open(path, 'w') as f:
+                generate(lines, f)
+            size = os.path.getsize(path) / (1 << 20)
+
+            times, peak = run_once(opts.pl0, args, path)
+            for phase in PHASES:
+                ms, rss = times.get(phase, (0.0, 0.0))
+                print(f'{lines:>10} {size:>7.1f} {phase:<8} {ms:>10.1f} '
+                      f'{ms * 1e3 / lines:>8.3f} {rss:>8.1f}')
+            print(f'{lines:>10} {size:>7.1f} {"peak":<8} {"":>10} {"":>8} '
+                  f'{peak:>8.1f}')
+            lines *= 10
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+#
+#  serve.py - request latency of `pl0 --serve` against cold process starts
+#
+#  usage: serve.py [--pl0 PATH] [--client PATH] [--runs N] [program]
+#                  [-- pl0 options...]
+#
+#  Starts `pl0 --serve` on a temporary socket and runs the program N times
+#  as a fresh `pl0` process, through `pl0 --client` and through the
+#  LLVM-free `pl0-client`. Prints p50/p99 latency in milliseconds.
+#
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def percentile(values, p):
+    values = sorted(values)
+    k = (len(values) - 1) * p / 100
+    i = int(k)
+    j = min(i + 1, len(values) - 1)
+    return values[i] + (values[j] - values[i]) * (k - i)
+
+
+def measure(command, runs):
+    samples = []
+    for _ in range(runs):
+        start = time.perf_counter()
+        subprocess.run(command, stdin=subprocess.DEVNULL,
+                       stdout=subprocess.DEVNULL, check=True)
+        samples.append((time.perf_counter() - start) * 1e3)
+    return samples
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--pl0', default=os.path.join(ROOT, 'pl0'))
+    parser.add_argument('--client', default=os.path.join(ROOT, 'pl0-client'))
+    parser.add_argument('--runs', type=int, default=200)
+    parser.add_argument('program', nargs='?',
+                        default=os.path.join(ROOT, 'samples/square.pas'))
+    parser.add_argument('args', nargs='*', help='options passed to pl0')
+    opts = parser.parse_args()
+    program = opts.args + [opts.program]
+
+    with tempfile.TemporaryDirectory() as tmp:
+        socket = os.path.join(tmp, 'pl0.sock')
+        server = subprocess.Popen([opts.pl0, '--serve', socket])
+        try:
+            while not os.path.exists(socket):
+                time.sleep(0.01)
+
+            cases = [('cold start', [opts.pl0] + program),
+                     ('pl0 --client',
+                      [opts.pl0, '--client', socket] + program)]
+            if os.path.exists(opts.client):
+                cases.append(('pl0-client', [opts.client, socket] + program))
+
+            print(f'{"":<14} {"p50 ms":>10} {"p99 ms":>10}')
+            for name, command in cases:
+                samples = measure(command, opts.runs)
+                print(f'{name:<14} {percentile(samples, 50):>10.3f} '
+                      f'{percentile(samples, 99):>10.3f}')
+        finally:
+            server.terminate()
+            server.wait()
+
+
+if __name__ == '__main__':
+    sys.exit(main())
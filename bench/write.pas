@@ -0,0 +1,9 @@
+VAR i;
+
+BEGIN
+  i := 0;
+  WHILE i < 10000000 DO BEGIN
+    ! i - 5000000;
+    i := i + 1
+  END
+END.
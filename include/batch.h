@@ -0,0 +1,29 @@
+#ifndef PL0_BATCH_H
+#define PL0_BATCH_H
+
+#include <functional>
+#include <ostream>
+#include <string>
+
+namespace pl0 {
+
+// Batch runner (--batch DIR). Runs every `.pas` file of the directory in
+// this process on `jobs` worker threads, which take the next program in
+// name order as they become free, so parsing, LLVM initialization and the
+// runtime are set up once per thread instead of once per program. `run`
+// compiles and runs one program on the calling thread and writes its
+// diagnostics to `err`; the program's output (including the message of a
+// runtime error) is captured per program, and its input is `NAME.in` next
+// to `NAME.pas` when there is one (otherwise it's empty).
+//
+// Results are printed in name order as soon as they're complete: a
+// `==> PATH <==` line and the output on stdout, the diagnostics on stderr,
+// and finally the number of programs and the throughput on stderr. The
+// status is 1 when `run` returned non-zero for any program.
+int batch(const std::string& dir, unsigned jobs,
+          const std::function<int(const std::string& path, std::ostream& err)>&
+              run);
+
+}  // namespace pl0
+
+#endif  // PL0_BATCH_H
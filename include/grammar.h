@@ -8,17 +8,18 @@ constexpr auto grammar = R"(
 
   block      <- const var procedure statement
   const      <- ('CONST' __ ident '=' _ number (',' _ ident '=' _ number)* ';' _)?
-  var        <- ('VAR' __ ident (',' _ ident)* ';' _)?
+  var        <- ('VAR' __ variable (',' _ variable)* ';' _)?
+  variable   <- ident ('[' _ number ']' _)?
   procedure  <- ('PROCEDURE' __ ident ';' _ block ';' _)*
 
   statement  <- (assignment / call / statements / if / while / out / in)?
-  assignment <- ident ':=' _ expression
+  assignment <- (element / ident) ':=' _ expression
   call       <- 'CALL' __ ident
   statements <- 'BEGIN' __ statement (';' _ statement )* 'END' __
   if         <- 'IF' __ condition 'THEN' __ statement
   while      <- 'WHILE' __ condition 'DO' __ statement
   out        <- ('out' __ / 'write' __ / '!' _) expression
-  in         <- ('in' __ / 'read' __ / '?' _) ident
+  in         <- ('in' __ / 'read' __ / '?' _) (element / ident)
 
   condition  <- odd / compare
   odd        <- 'ODD' __ expression
@@ -32,7 +33,8 @@ constexpr auto grammar = R"(
   term       <- factor (factor_op factor)*
   factor_op  <- < [*/] > _
 
-  factor     <- ident / number / '(' _ expression ')' _
+  factor     <- element / ident / number / '(' _ expression ')' _
+  element    <- ident '[' _ expression ']' _
 
   ident      <- < [a-z] [a-z0-9]* > _
   number     <- < [0-9]+ > _
@@ -0,0 +1,131 @@
+#ifndef PL0_INTERPRETER_H
+#define PL0_INTERPRETER_H
+
+#include "ir.h"
+#include "options.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace pl0 {
+
+class JITCompiler;
+
+// Bytecode interpreter for PL/0. The resolved AST is compiled into compact
+// stack machine code per procedure, executed with direct threaded dispatch.
+// In tiered mode, procedures whose calls plus loop back-edges cross the hot
+// threshold are JIT-compiled and called natively from then on.
+class Interpreter {
+ public:
+  // Compile and execute the program
+  static void run(const Program& program, const Options& options);
+
+  ~Interpreter();
+
+ private:
+  enum Op : int32_t {
+    kPush,       // value
+    kLoad,       // local slot
+    kStore,      // local slot
+    kLoadFree,   // free variable index
+    kStoreFree,  // free variable index
+    // Array elements (index on the stack, below the value to store)
+    kLoadElement,       // local slot, size
+    kStoreElement,      // local slot, size
+    kLoadFreeElement,   // free variable index, size
+    kStoreFreeElement,  // free variable index, size
+    kNeg,
+    kAdd,
+    kSub,
+    kMul,
+    kDiv,
+    kOdd,
+    kEq,
+    kNe,
+    kLt,
+    kLe,
+    kGt,
+    kGe,
+    kJump,        // target
+    kJumpIfZero,  // target
+    kLoop,        // target (loop back-edge)
+    kCall,        // call site
+    kOut,
+    kIn,
+    kReturn,
+  };
+
+  // Code slot: an opcode (a label address once threaded) or an operand
+  union Slot {
+    int32_t value;
+    const void* label;
+  };
+
+  // Variable reference: a local slot (>= 0) or a free variable (~index).
+  // The elements of a local array take consecutive slots and a free array
+  // is passed as a pointer to its first element.
+  typedef int32_t Ref;
+
+  struct CallSite {
+    size_t proc;
+    std::vector<Ref> args;
+  };
+
+  struct Proc {
+    std::vector<ir::Index> free;  // declarations
+    uint32_t locals = 0;
+    uint32_t max_stack = 0;
+    std::vector<Slot> code;
+    bool threaded = false;
+
+    // Tiering
+    uint32_t heat = 0;
+    bool promoted = false;
+    void (*entry)(int32_t**) = nullptr;
+  };
+
+  Options options_;
+  const Program& program_;
+  std::vector<Proc> procs_;  // procs_[i] is compiled from blocks[i]
+  std::vector<CallSite> call_sites_;
+  std::unique_ptr<JITCompiler> jit_;
+
+  // Frames (locals and operand stack) and free variable pointer arrays
+  std::unique_ptr<int32_t[]> stack_;
+  int32_t* stack_top_ = nullptr;
+  int32_t* stack_end_ = nullptr;
+  std::unique_ptr<int32_t*[]> args_;
+  int32_t** args_top_ = nullptr;
+  int32_t** args_end_ = nullptr;
+
+  // Heat at which a procedure is promoted, 0 outside tiered mode where
+  // nothing is counted
+  uint32_t threshold_ = 0;
+
+  // Bytecode compiler state
+  size_t proc_ = 0;
+  uint32_t depth_ = 0;
+  std::vector<Ref> refs_;  // by declaration, in the procedure being compiled
+
+  Interpreter(const Program& program, const Options& options);
+
+  // Bytecode compilation
+  size_t compile_block(ir::Index index);
+  void compile_statement(ir::Index index);
+  void compile_expression(ir::Index index);
+  void emit(Op op, int delta);
+  size_t emit(Op op, int delta, int32_t operand);
+  void emit_store(Ref ref);
+  void emit_element(Op local, Op free, int delta, ir::Index decl);
+  Ref resolve(ir::Index decl) const { return refs_[decl]; }
+
+  // Execution
+  void execute(Proc& proc, int32_t** free);
+  void call(const CallSite& site, int32_t* locals, int32_t** free);
+  void promote(Proc& proc);
+};
+
+}  // namespace pl0
+
+#endif  // PL0_INTERPRETER_H
@@ -0,0 +1,170 @@
+#ifndef PL0_IR_H
+#define PL0_IR_H
+
+#include "ast.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace pl0 {
+
+// Compact form of a parsed program that the symbol table, the JIT and the
+// interpreter work on. The AST is lowered once into flat node arrays owned
+// by a `Program`; nodes refer to each other by index, wrapper nodes such as
+// `statement` and `factor` are collapsed and identifiers are interned.
+namespace ir {
+
+// Position in one of the node arrays
+typedef uint32_t Index;
+constexpr Index kNone = UINT32_MAX;
+
+// Largest number of elements of an array (64 MiB)
+constexpr uint32_t kMaxArraySize = 1 << 24;
+
+// Interned identifier (position in `Program::names`)
+typedef uint32_t Name;
+
+struct Location {
+  uint32_t line = 0;
+  uint32_t column = 0;
+};
+
+enum class ExprKind : uint8_t {
+  number,    // value
+  variable,  // name, decl
+  element,   // name, decl (an array), lhs (index)
+  neg,       // lhs
+  add,
+  sub,
+  mul,
+  div,
+  div_nonzero,  // divisor known to be non-zero (set by the range analysis)
+  // Conditions
+  odd,  // lhs
+  eq,
+  ne,
+  lt,
+  le,
+  gt,
+  ge,
+};
+
+struct Expr {
+  ExprKind kind;
+  int32_t value;  // number
+  Name name;      // variable, element
+  Index decl;     // variable, element (resolved by the symbol table)
+  Index lhs;
+  Index rhs;
+  Location loc;
+};
+
+enum class StmtKind : uint8_t {
+  empty,
+  assignment,  // name := expr or name[index] := expr, target
+  call,        // name, target
+  statements,  // `count` statements from `Program::lists[first]`
+  if_,         // expr (condition), body
+  while_,      // expr (condition), body
+  out,         // expr
+  in,          // name or name[index], target
+};
+
+struct Stmt {
+  StmtKind kind;
+  Name name;
+  Index index;  // element of an array (assignment, in), or kNone
+  Index expr;
+  Index body;
+  Index first;
+  uint32_t count;
+  // Resolved by the symbol table: the called block or the assigned variable
+  // (`Program::decls`)
+  Index target;
+  Location loc;
+};
+
+// Constant or variable declaration
+struct Decl {
+  Name name;
+  int32_t value;  // constants
+  uint32_t size;  // elements of an array variable (0 for scalars)
+  Index block;    // declaring block
+  Location loc;
+};
+
+// A `Range` selects `count` entries of an array starting at `first`
+struct Range {
+  Index first = 0;
+  uint32_t count = 0;
+};
+
+struct Block {
+  Name name;    // procedure name (the main block has `kNone`)
+  Index outer;  // enclosing block
+  Range consts;  // Program::decls
+  Range vars;    // Program::decls
+  Range procs;   // Program::lists (block indices)
+  Index body;    // statement
+  Location loc;  // procedure name (the main block: its body)
+
+  // Filled in by the symbol table: outer variables used by the block and
+  // the procedures it calls, in declaration order (Program::lists, indices
+  // into Program::decls)
+  Range free;
+
+  // Filled in by the memo analysis (--memo) for procedures whose effect
+  // only depends on outer variables: the free variables that may be read
+  // before they are written (the key of the memo table) and those that may
+  // be written (the result). Both in Program::lists.
+  bool memo = false;
+  Range inputs;
+  Range outputs;
+};
+
+}  // namespace ir
+
+struct Program {
+  std::string path;
+
+  std::vector<std::string> names;
+  std::vector<ir::Block> blocks;  // blocks[0] is the main block
+  std::vector<ir::Stmt> stmts;
+  std::vector<ir::Expr> exprs;
+  std::vector<ir::Decl> decls;
+  std::vector<ir::Index> lists;
+
+  // Lower a parsed program
+  static Program lower(const AstPL0& ast);
+
+  std::string_view name(ir::Name name) const { return names[name]; }
+
+  // Position of a variable among the variables of its block. Together with
+  // the declaring block this is the variable's address; the symbol table
+  // replaces uses of constants with their values, so they have none.
+  uint32_t slot(ir::Index decl) const {
+    return decl - blocks[decls[decl].block].vars.first;
+  }
+
+  // Entries of a range of `decls`/`lists`
+  const ir::Decl* decls_of(ir::Range range) const {
+    return decls.data() + range.first;
+  }
+  const ir::Index* list_of(ir::Range range) const {
+    return lists.data() + range.first;
+  }
+
+  // Total number of nodes
+  size_t size() const {
+    return blocks.size() + stmts.size() + exprs.size() + decls.size();
+  }
+};
+
+// Throw a runtime error at a location of the program
+void throw_runtime_error(const Program& program, ir::Location loc,
+                         const std::string& msg);
+
+}  // namespace pl0
+
+#endif  // PL0_IR_H
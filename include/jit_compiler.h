@@ -1,60 +1,178 @@
 #ifndef PL0_JIT_COMPILER_H
 #define PL0_JIT_COMPILER_H
 
-#include "ast.h"
+#include "ir.h"
+#include "options.h"
+#include "profile_data.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
+#include "llvm/IR/ProfileSummary.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Target/TargetMachine.h"
 #include <memory>
+#include <vector>
 
 namespace pl0 {
 
+class ObjectFileCache;
+
 // JIT compiler for PL/0 using LLVM
 class JITCompiler {
  public:
-  // Compile and execute the AST
-  static void run(const std::shared_ptr<AstPL0> ast);
+  // Compile and execute the program
+  // (with a cache, the compiled object is stored under the given key). The
+  // program is freed once it's turned into LLVM IR, and the IR and its
+  // context once it's turned into machine code, before `main` runs; with
+  // lazy compilation the IR of procedures that haven't been called yet
+  // stays.
+  static void run(Program program, const Options& options,
+                  ObjectFileCache* cache = nullptr,
+                  const std::string& key = "");
+
+  // Execute a previously compiled object
+  static void run(std::unique_ptr<llvm::MemoryBuffer> object,
+                  const Options& options);
+
+  // Compile ahead of time into the files given by the `emit_*` options
+  static void emit(const Program& program, const Options& options);
+
+  // Compile the program without running it. Each procedure gets an adapter
+  // taking its free variable pointers as an array.
+  static std::unique_ptr<JITCompiler> load(const Program& program,
+                                           const Options& options);
+
+  // Address of the adapter of a procedure by block (materialized on demand)
+  void* entry(ir::Index block);
+
+  // Register the native target (done on first use; `--serve` calls it up
+  // front)
+  static void initialize();
 
  private:
-  llvm::LLVMContext context_;
+  Options options_;
+  ObjectFileCache* cache_ = nullptr;
+  std::unique_ptr<llvm::TargetMachine> tm_;
+  llvm::orc::ThreadSafeContext tsctx_;
+  llvm::LLVMContext& context_;
   llvm::IRBuilder<> builder_;
   std::unique_ptr<llvm::Module> module_;
   llvm::GlobalVariable* tyinfo_ = nullptr;
+  const Program* program_ = nullptr;
+  bool arrays_ = false;  // the program declares arrays
+  bool entries_ = false;
+  std::unique_ptr<llvm::orc::LLJIT> jit_;
+
+  // Variable storage of a block in `--frames` mode. Variables used by nested
+  // procedures live in the frame record (globals in the main block), which
+  // starts with the static link when the block has one.
+  struct Frame {
+    const Frame* outer = nullptr;
+    ir::Index block = ir::kNone;
+    std::vector<llvm::Value*> variables;  // by slot
+    std::vector<unsigned> fields;         // record field by slot (captured)
+    llvm::StructType* type = nullptr;
+    llvm::Value* record = nullptr;
+    llvm::Value* link = nullptr;
+  };
+  const Frame* frame_ = nullptr;
+
+  // Otherwise each variable (by declaration) is an alloca or a pointer
+  // argument of the function being compiled
+  std::vector<llvm::Value*> values_;
+
+  // Alignment of arrays (a cache line)
+  static constexpr unsigned kArrayAlign = 64;
+
+  // Function of each procedure and the symbol of its adapter (by block).
+  // Procedures are named by their nesting, which LLVM makes unique when two
+  // of them share it, so they are never looked up by name.
+  std::vector<llvm::Function*> functions_;
+  std::vector<std::string> entry_symbols_;
+
+  // Memo table handle of each memoized procedure (by block, --memo)
+  std::vector<llvm::GlobalVariable*> memo_tables_;
+
+  // Profile counters of each block and the cycles spent in the callees of
+  // the running procedure (--profile, --profile-out). `__pl0_profile_init`
+  // registers the counters with the runtime.
+  std::vector<llvm::GlobalVariable*> profile_counters_;
+  llvm::GlobalVariable* profile_callees_ = nullptr;
+  llvm::BasicBlock* profile_init_ = nullptr;
+  ir::Index block_ = ir::kNone;  // block being compiled
+
+  // Fuel left (--fuel)
+  llvm::GlobalVariable* fuel_ = nullptr;
+
+  // Counts of a previous run (--profile-use) and their summary, which each
+  // module that gets optimized needs for the profile to guide inlining
+  std::unique_ptr<ProfileData> profile_data_;
+  std::unique_ptr<llvm::ProfileSummary> profile_summary_;
+
+  // Cycle counter and the saved callee cycles at the entry of a procedure
+  struct ProfileEntry {
+    llvm::Value* start = nullptr;
+    llvm::Value* callees = nullptr;
+  };
+
+  JITCompiler(const Options& options);
 
-  JITCompiler();
+  static llvm::orc::JITTargetMachineBuilder target_machine_builder(
+      const Options& options);
+  static llvm::orc::LLJITBuilderState::ObjectLinkingLayerCreator object_layer(
+      const Options& options);
+  static void define_runtime(llvm::orc::LLJIT& jit);
+  static void run_main(llvm::orc::LLJIT& jit);
 
-  void compile(const std::shared_ptr<AstPL0> ast);
+  void compile(const Program& program);
+  void optimize(llvm::Module& module, llvm::TargetMachine& tm);
+  void create_jit();
+  std::vector<std::unique_ptr<llvm::MemoryBuffer>> compile_parallel();
   void exec();
-  void dump();
+  void release();
+  void dump(const std::string& path);
+  void emit_file(const std::string& path, llvm::CodeGenFileType type);
+  void link(const std::string& obj, const std::string& exe);
 
   // Compilation methods
   void compile_libs();
-  void compile_program(const std::shared_ptr<AstPL0> ast);
-  void compile_block(const std::shared_ptr<AstPL0> ast);
-  void compile_const(const std::shared_ptr<AstPL0> ast);
-  void compile_var(const std::shared_ptr<AstPL0> ast);
-  void compile_procedure(const std::shared_ptr<AstPL0> ast);
-  void compile_statement(const std::shared_ptr<AstPL0> ast);
-  void compile_assignment(const std::shared_ptr<AstPL0> ast);
-  void compile_call(const std::shared_ptr<AstPL0> ast);
-  void compile_statements(const std::shared_ptr<AstPL0> ast);
-  void compile_if(const std::shared_ptr<AstPL0> ast);
-  void compile_while(const std::shared_ptr<AstPL0> ast);
-  void compile_out(const std::shared_ptr<AstPL0> ast);
+  void compile_program();
+  void compile_block(ir::Index index);
+  void compile_var(const ir::Block& block);
+  llvm::Value* compile_storage(ir::Index decl, bool global);
+  void compile_frame(ir::Index index, Frame& frame);
+  void compile_procedure(const ir::Block& outer);
+  void compile_statement(ir::Index index);
+  void compile_assignment(const ir::Stmt& stmt);
+  void compile_call(const ir::Stmt& stmt);
+  void compile_memo_call(ir::Index index, llvm::Function* fn,
+                         const std::vector<llvm::Value*>& args);
+  void compile_profile_counters();
+  void compile_profile_summary();
+  std::string profile_name(ir::Index block) const;
+  llvm::MDNode* profile_weights(const char* kind, ir::Location loc);
+  ProfileEntry compile_profile_enter(ir::Index index);
+  void compile_profile_exit(ir::Index index, const ProfileEntry& entry);
+  void compile_statements(const ir::Stmt& stmt);
+  void compile_if(const ir::Stmt& stmt);
+  void compile_while(const ir::Stmt& stmt);
+  void compile_out(const ir::Stmt& stmt);
+  void compile_in(const ir::Stmt& stmt);
 
   // Value compilation methods
-  llvm::Value* compile_condition(const std::shared_ptr<AstPL0> ast);
-  llvm::Value* compile_odd(const std::shared_ptr<AstPL0> ast);
-  llvm::Value* compile_compare(const std::shared_ptr<AstPL0> ast);
-  llvm::Value* compile_expression(const std::shared_ptr<AstPL0> ast);
-  llvm::Value* compile_term(const std::shared_ptr<AstPL0> ast);
-  llvm::Value* compile_factor(const std::shared_ptr<AstPL0> ast);
-  llvm::Value* compile_ident(const std::shared_ptr<AstPL0> ast);
-  llvm::Value* compile_number(const std::shared_ptr<AstPL0> ast);
+  llvm::Value* compile_condition(ir::Index index);
+  llvm::Value* compile_expression(ir::Index index);
+  llvm::Value* compile_divide(llvm::Value* val, llvm::Value* rval);
+  llvm::Value* compile_element(ir::Index decl, llvm::Value* index);
+  void compile_error(const char* msg, const char* name);
+  void compile_fuel(ir::Location loc);
 
   // Helper methods
-  void compile_switch(const std::shared_ptr<AstPL0> ast);
-  llvm::Value* compile_switch_value(const std::shared_ptr<AstPL0> ast);
+  llvm::Value* compile_variable(ir::Index decl);
+  llvm::Value* compile_record(const Frame* frame);
 };
 
 }  // namespace pl0
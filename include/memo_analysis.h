@@ -0,0 +1,47 @@
+#ifndef PL0_MEMO_ANALYSIS_H
+#define PL0_MEMO_ANALYSIS_H
+
+#include "ir.h"
+#include <set>
+#include <vector>
+
+namespace pl0 {
+
+// Finds procedures that can be memoized (--memo): no `in`/`out` or outer
+// arrays in them or anything they call, so the only effect of a call is on
+// outer variables, and that effect is determined by the outer variables
+// read before being written. Sets `Block::memo`, `inputs` and `outputs`.
+// Procedures without a loop or a call are cheaper to run than to look up
+// and are left alone. Runs after the symbol table, which provides the free
+// variables and call targets.
+class MemoAnalysis {
+ public:
+  static void run(Program& program);
+
+ private:
+  Program& program_;
+
+  // Per block, growing until a fixpoint since calls form cycles: whether
+  // it (or a callee) does input or output, and the outer variables it may
+  // read before writing and may write. `work_` is set for blocks with a
+  // loop or a call.
+  std::vector<bool> io_;
+  std::vector<bool> work_;
+  std::vector<std::set<ir::Index>> reads_;
+  std::vector<std::set<ir::Index>> writes_;
+  bool changed_ = false;
+
+  MemoAnalysis(Program& program);
+
+  void block(ir::Index index);
+  void statement(ir::Index block, ir::Index index, std::set<ir::Index>& defs);
+  void expression(ir::Index block, ir::Index index,
+                  const std::set<ir::Index>& defs);
+  void read(ir::Index block, ir::Index decl, const std::set<ir::Index>& defs);
+  void write(ir::Index block, ir::Index decl);
+  void outer_array(ir::Index block, ir::Index decl);
+};
+
+}  // namespace pl0
+
+#endif  // PL0_MEMO_ANALYSIS_H
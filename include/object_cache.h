@@ -0,0 +1,44 @@
+#ifndef PL0_OBJECT_CACHE_H
+#define PL0_OBJECT_CACHE_H
+
+#include "options.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace pl0 {
+
+// On-disk cache of compiled objects. One object file per program is stored
+// in the cache directory under a key made of the source bytes, the compiler
+// options and the host target, so a warm run can skip parsing and codegen.
+class ObjectFileCache : public llvm::ObjectCache {
+ public:
+  ObjectFileCache(const std::string& dir);
+
+  // Compute the cache key for a program
+  static std::string key(std::string_view source, const Options& options);
+
+  // Load the object stored for the key, or nullptr on a miss
+  std::unique_ptr<llvm::MemoryBuffer> load(const std::string& key);
+
+  // llvm::ObjectCache (modules are identified by their cache key)
+  void notifyObjectCompiled(const llvm::Module* module,
+                            llvm::MemoryBufferRef object) override;
+  std::unique_ptr<llvm::MemoryBuffer> getObject(
+      const llvm::Module* module) override;
+
+  size_t hits = 0;
+  size_t misses = 0;
+  size_t stores = 0;
+
+ private:
+  std::string dir_;
+
+  std::string path(const std::string& key) const;
+};
+
+}  // namespace pl0
+
+#endif  // PL0_OBJECT_CACHE_H
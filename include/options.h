@@ -0,0 +1,116 @@
+#ifndef PL0_OPTIONS_H
+#define PL0_OPTIONS_H
+
+#include <cstdint>
+#include <string>
+
+namespace pl0 {
+
+// How the program is executed
+enum class Mode {
+  jit,     // compile everything with the JIT
+  interp,  // bytecode interpreter only
+  tiered,  // interpret, and hand hot procedures over to the JIT
+};
+
+// Compiler options given on the command line
+struct Options {
+  // Optimization level (-O0 .. -O3)
+  unsigned opt_level = 2;
+
+  // Generate machine code for each procedure on its first call (--eager
+  // compiles the whole module before `main` runs)
+  bool lazy = true;
+
+  // Threads that optimize and code-generate the program (-j N). With more
+  // than one, the module is split into partitions that are compiled
+  // concurrently before `main` runs.
+  unsigned jobs = 1;
+
+  // Closure conversion (--frames): procedures reach outer variables through
+  // one static link to a frame record instead of a pointer per variable
+  bool frames = false;
+
+  // Report runtime errors (divide by 0, bad input) through a noreturn
+  // runtime call that ends the process instead of a C++ exception, so
+  // procedures need no unwind tables (--fast-fail). Only in jit mode; the
+  // interpreter and tiered mode always catch exceptions.
+  bool fast_fail = false;
+
+  // Memoize calls of procedures without input or output whose result only
+  // depends on the outer variables they read (--memo). Each procedure gets
+  // a table of `memo_size` entries (--memo-size N, at most
+  // `max_memo_size`); jit mode only.
+  bool memo = false;
+  unsigned memo_size = 4096;
+  static constexpr unsigned max_memo_size = 1u << 24;
+
+  // Count calls, cycles and loop iterations per procedure and report them
+  // at exit (--profile), also as JSON to `profile_json` (--profile-json
+  // FILE); jit mode only
+  bool profile = false;
+  std::string profile_json;
+
+  // Profile-guided optimization: record calls, loop and IF counts of a run
+  // (--profile-out FILE, jit mode), then compile with them as function entry
+  // counts and branch weights (--profile-use FILE)
+  std::string profile_out;
+  std::string profile_use;
+
+  // Whether the generated code counts calls, loops and branches
+  bool counting() const { return profile || !profile_out.empty(); }
+
+  // Budget of loop iterations plus procedure calls (--fuel N, 0: no limit).
+  // Every WHILE back edge and procedure entry takes one unit, and a program
+  // that runs out stops with "out of fuel at LINE:COLUMN" like on a runtime
+  // error. Nothing is generated without it; jit mode only.
+  uint64_t fuel = 0;
+
+  // Make JIT compiled code visible to tools: --perf-map appends the address
+  // and size of each function to /tmp/perf-<pid>.map for `perf report`,
+  // --jitdump writes a jitdump file for `perf inject --jit` (when LLVM is
+  // built with perf support) and --gdb registers each object with GDB's JIT
+  // interface
+  bool perf_map = false;
+  bool jitdump = false;
+  bool gdb = false;
+
+  // Execution mode (--mode jit|interp|tiered)
+  Mode mode = Mode::jit;
+
+  // Calls plus loop back-edges after which the tiered mode JIT-compiles a
+  // procedure
+  unsigned hot_threshold = 1000;
+
+  // Directory of the compiled object cache (disabled when empty)
+  std::string cache_dir;
+
+  // Print object cache hit/miss counters
+  bool cache_stats = false;
+
+  // Print phase timings and counters to stderr (--stats)
+  bool stats = false;
+
+  // Write phase timings as Chrome trace events (--trace FILE)
+  std::string trace;
+
+  // Run every `.pas` file of the directory given as the program, on `jobs`
+  // threads that each compile their programs on their own (--batch)
+  bool batch = false;
+
+  // Ahead-of-time outputs (the program is not executed when any is set)
+  std::string emit_obj;       // native object file
+  std::string emit_exe;       // executable linked with the runtime
+  std::string emit_asm;       // optimized assembly
+  std::string emit_llvm;      // optimized LLVM IR
+  std::string emit_llvm_pre;  // LLVM IR before optimization
+
+  bool compile_only() const {
+    return !emit_obj.empty() || !emit_exe.empty() || !emit_asm.empty() ||
+           !emit_llvm.empty() || !emit_llvm_pre.empty();
+  }
+};
+
+}  // namespace pl0
+
+#endif  // PL0_OPTIONS_H
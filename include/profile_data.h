@@ -0,0 +1,42 @@
+#ifndef PL0_PROFILE_DATA_H
+#define PL0_PROFILE_DATA_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace pl0 {
+
+// Counts recorded with `--profile-out FILE` that `--profile-use FILE` turns
+// into function entry counts and branch weights. The file is text, written
+// by `__pl0_profile_write_counts`, one site per line after a header:
+//
+//   pl0-profile 1
+//   proc NAME CALLS
+//   loop NAME LINE:COLUMN ENTRIES ITERATIONS
+//   if NAME LINE:COLUMN EXECUTIONS TAKEN
+//
+// NAME is the procedure (`outer.inner` when nested, `main` for the main
+// block) and LINE is relative to the line of the procedure's name, so
+// editing a procedure leaves the counts of the others valid. Sites that
+// aren't in the file get no profile.
+class ProfileData {
+ public:
+  // Throws std::runtime_error when the file can't be read or parsed
+  static ProfileData load(const std::string& path);
+
+  // Counts of a site by its key, the line up to the counts
+  // (`loop fib 3:3`), or null
+  const std::vector<uint64_t>* find(const std::string& key) const;
+
+  // Every count in the file
+  std::vector<uint64_t> counts() const;
+
+ private:
+  std::unordered_map<std::string, std::vector<uint64_t>> sites_;
+};
+
+}  // namespace pl0
+
+#endif  // PL0_PROFILE_DATA_H
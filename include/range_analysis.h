@@ -0,0 +1,38 @@
+#ifndef PL0_RANGE_ANALYSIS_H
+#define PL0_RANGE_ANALYSIS_H
+
+#include "ir.h"
+#include <vector>
+
+namespace pl0 {
+
+// Finds divisions whose divisor can't be zero and marks them
+// `ExprKind::div_nonzero`, so no zero check is generated for them. A
+// divisor is known to be non-zero when it's a non-zero constant, or a
+// variable that a condition (`IF b # 0`, `WHILE n > 0`, ...) or an
+// assignment of a non-zero constant established, and that nothing
+// (including called procedures) has written since. Runs on each block
+// body after the symbol table.
+class RangeAnalysis {
+ public:
+  static void run(Program& program);
+
+ private:
+  // Variables known to be non-zero (sorted declarations)
+  typedef std::vector<ir::Index> Facts;
+
+  Program& program_;
+
+  RangeAnalysis(Program& program) : program_(program) {}
+
+  void statement(ir::Index index, Facts& facts);
+  void expression(ir::Index index, const Facts& facts);
+  bool nonzero(ir::Index index, const Facts& facts) const;
+  void assume(ir::Index cond, bool holds, Facts& facts) const;
+  void kill(ir::Index index, Facts& facts) const;
+  void kill_call(ir::Index block, Facts& facts) const;
+};
+
+}  // namespace pl0
+
+#endif  // PL0_RANGE_ANALYSIS_H
@@ -0,0 +1,100 @@
+#ifndef PL0_RUNTIME_H
+#define PL0_RUNTIME_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Native runtime called by generated code. It is linked into the JIT and
+// archived as libpl0rt.a for ahead-of-time executables.
+extern "C" {
+
+// `out`/`write`/`!` statement: print a number followed by a newline
+void __pl0_out(int32_t value);
+
+// Write buffered output to stdout
+void __pl0_flush();
+
+// `in`/`read`/`?` statement: read the next whitespace separated number from
+// stdin. Throws "end of input" when stdin is exhausted and "invalid input" on
+// anything but an optionally signed decimal number (which wraps to 32 bits).
+// After `__pl0_fast_fail` these are reported with `__pl0_error` instead.
+int32_t __pl0_in();
+
+// Memo table of a procedure (--memo) that maps the values of `inputs` outer
+// variables to the values of `outputs` outer variables after the call. It
+// holds at most `size` entries in 4-way sets and evicts the least recently
+// used entry of a set. A table that rarely hits turns itself off.
+void* __pl0_memo_table(const char* name, int32_t inputs, int32_t outputs,
+                       int32_t size);
+
+// Copy the outputs cached for the key to `values`; 0 on a miss
+int32_t __pl0_memo_lookup(void* table, const int32_t* key, int32_t* values);
+
+// Cache the outputs for the key
+void __pl0_memo_store(void* table, const int32_t* key, const int32_t* values);
+
+// Print the calls, hits, evictions and bypassed lookups of each table to
+// stderr
+void __pl0_memo_report();
+
+// Profile counters (--profile, --profile-out). Generated code updates them
+// without atomics. A procedure has 4: calls, active calls, cycles of its
+// outermost active calls and cycles spent in its own code (`self`, without
+// callees); only calls are counted without --profile. `line` and `column`
+// are the position of its name.
+void __pl0_profile_proc(const char* name, int32_t line, int32_t column,
+                        uint64_t* counters);
+
+// Counters of a WHILE loop in the procedure `proc`: iterations (back
+// edges) and entries
+void __pl0_profile_loop(const char* proc, int32_t line, int32_t column,
+                        uint64_t* counters);
+
+// Counters of an IF statement: executions and how often the condition held
+void __pl0_profile_branch(const char* proc, int32_t line, int32_t column,
+                          uint64_t* counters);
+
+// Copy the counters out of the generated code before it's freed
+void __pl0_profile_save();
+
+// Print the procedures sorted by self cycles and the loops by iterations
+// to stderr
+void __pl0_profile_report();
+
+// Write the profile as JSON; 0 when the file can't be written
+int32_t __pl0_profile_write(const char* path);
+
+// Write the counts for `--profile-use` (see profile_data.h); 0 when the
+// file can't be written
+int32_t __pl0_profile_write_counts(const char* path);
+
+// Flush the output and print the message of a runtime error on a line of
+// its own (the landing pad of `main` and the interpreter)
+void __pl0_print_error(const char* msg);
+
+// Report runtime errors with `__pl0_error` from now on (--fast-fail)
+void __pl0_fast_fail();
+
+// Flush the output, print the message like the landing pad of `main` does
+// and end the process with status 0
+[[noreturn]] void __pl0_error(const char* msg);
+
+}
+
+namespace pl0 {
+
+// The output buffer, the input reader and --fast-fail are per thread, so
+// that a batch (--batch) can run programs on several threads. These
+// redirect the calling thread's program:
+
+// Append the output to `out` instead of writing it to stdout (null: back to
+// stdout). Drops anything still buffered.
+void capture_output(std::string* out);
+
+// Read `in` statements from `data`, which has to outlive the program
+void set_input(std::string_view data);
+
+}  // namespace pl0
+
+#endif  // PL0_RUNTIME_H
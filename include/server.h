@@ -0,0 +1,31 @@
+#ifndef PL0_SERVER_H
+#define PL0_SERVER_H
+
+#include <functional>
+#include <string>
+
+namespace pl0 {
+
+// Compile server (--serve SOCKET). Listens on a Unix domain socket and runs
+// each request in a child forked from the warm server process, so the
+// prepared parser and the initialized LLVM target are shared and a program
+// that crashes or hangs doesn't take the server down.
+//
+// A request carries the client's stdin, stdout and stderr as descriptors
+// (SCM_RIGHTS) with a 4 byte payload length, followed by the payload: the
+// client's working directory and the command line arguments, each NUL
+// terminated. The child runs with those descriptors as 0, 1 and 2, so the
+// program reads the client's input and writes straight to its output. When
+// the child ends the server replies with its exit status (4 bytes, 128 +
+// signal number when it was killed).
+int serve(const std::string& path,
+          const std::function<int(int argc, const char** argv)>& run);
+
+// Client (--client SOCKET, or the LLVM-free pl0-client): sends the
+// arguments and standard descriptors to the server and returns the exit
+// status of the program.
+int client(const std::string& path, int argc, const char** argv);
+
+}  // namespace pl0
+
+#endif  // PL0_SERVER_H
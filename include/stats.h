@@ -0,0 +1,43 @@
+#ifndef PL0_STATS_H
+#define PL0_STATS_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+namespace pl0 {
+
+// Phase timings and counters for `--stats` and `--trace`. Nothing is
+// recorded until `enable` is called. Phases may be recorded from several
+// threads; CPU time is per thread.
+class Stats {
+ public:
+  static void enable();
+  static bool enabled();
+
+  // Add to a named counter (names are string literals)
+  static void count(const char* name, uint64_t value);
+
+  // Summary per phase: wall time, CPU time, RSS and peak RSS when the phase
+  // ended, then the counters
+  static void print(std::ostream& os);
+
+  // Chrome trace event file (chrome://tracing, Perfetto); false when the
+  // file can't be written
+  static bool write_trace(const std::string& path);
+
+  // Records the enclosing scope as a phase. Phases nest, e.g. lazy
+  // compilation shows up inside "execute".
+  class Phase {
+   public:
+    Phase(const char* name);
+    ~Phase();
+
+   private:
+    size_t index_ = 0;
+  };
+};
+
+}  // namespace pl0
+
+#endif  // PL0_STATS_H
@@ -1,32 +1,61 @@
 #ifndef PL0_SYMBOL_TABLE_H
 #define PL0_SYMBOL_TABLE_H
 
-#include "ast.h"
-#include <memory>
+#include "ir.h"
+#include <cstddef>
+#include <set>
+#include <utility>
+#include <vector>
 
 namespace pl0 {
 
-// Symbol table builder - constructs symbol tables during semantic analysis
+// Symbol table builder - semantic analysis on the lowered program. Checks
+// declarations and uses, resolves every identifier to its declaration (or
+// constant value) and `CALL` targets to blocks, and computes the free
+// variables of each block, so code generation never looks up a name.
+// Operations on numbers are folded on the way, `IF`s whose condition is
+// known become their body or nothing, and so do `WHILE`s that never run.
 class SymbolTableBuilder {
  public:
-  static void build_on_ast(const std::shared_ptr<AstPL0> ast,
-                          std::shared_ptr<SymbolScope> scope = nullptr);
+  static void build(Program& program);
 
  private:
-  static void block(const std::shared_ptr<AstPL0> ast,
-                   std::shared_ptr<SymbolScope> outer);
-  static void constants(const std::shared_ptr<AstPL0> ast,
-                       std::shared_ptr<SymbolScope> scope);
-  static void variables(const std::shared_ptr<AstPL0> ast,
-                       std::shared_ptr<SymbolScope> scope);
-  static void procedures(const std::shared_ptr<AstPL0> ast,
-                        std::shared_ptr<SymbolScope> scope);
-  static void assignment(const std::shared_ptr<AstPL0> ast,
-                        std::shared_ptr<SymbolScope> scope);
-  static void call(const std::shared_ptr<AstPL0> ast,
-                  std::shared_ptr<SymbolScope> scope);
-  static void ident(const std::shared_ptr<AstPL0> ast,
-                   std::shared_ptr<SymbolScope> scope);
+  struct Value {
+    ir::Index decl;
+    bool constant;
+  };
+
+  struct Procedure {
+    ir::Index block;
+    ir::Index target;
+  };
+
+  Program& program_;
+
+  // Visible declarations of each name, innermost last
+  std::vector<std::vector<Value>> values_;
+  std::vector<std::vector<Procedure>> procedures_;
+
+  // Free variables (declarations) of each block and the calls made by each
+  // block (caller, callee)
+  std::vector<std::set<ir::Index>> free_;
+  std::vector<std::pair<ir::Index, ir::Index>> calls_;
+
+  // Folded expressions and removed `IF`/`WHILE` statements (--stats)
+  size_t folded_ = 0;
+  size_t removed_ = 0;
+
+  SymbolTableBuilder(Program& program);
+
+  void block(ir::Index index);
+  void declare(ir::Index decl, bool constant);
+  void statement(ir::Index block, ir::Index index);
+  void expression(ir::Index block, ir::Index index);
+  void indexed(ir::Index decl, bool index, ir::Location loc);
+  bool condition(ir::Index index, bool& holds) const;
+  void use(ir::Index block, ir::Index decl);
+  void propagate();
+  const Value* lookup(ir::Name name) const;
 };
 
 }  // namespace pl0
@@ -8,6 +8,11 @@ namespace pl0 {
 std::string format_error_message(const std::string& path, size_t ln, size_t col,
                                  const std::string& msg);
 
+// Give memory freed on the heap back to the system (glibc keeps it in the
+// process otherwise), so that what's freed before a program runs doesn't
+// stay resident while it runs
+void trim_heap();
+
 }  // namespace pl0
 
 #endif  // PL0_UTILS_H
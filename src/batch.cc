@@ -0,0 +1,125 @@
+#include "batch.h"
+#include "runtime.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace pl0 {
+
+namespace {
+
+struct Result {
+  std::string out;
+  std::string err;
+  int status = 0;
+  bool done = false;
+};
+
+// Input of a program: NAME.in next to NAME.pas, or nothing
+std::string read_input(const std::string& path) {
+  auto input = std::filesystem::path(path).replace_extension(".in");
+  std::ifstream ifs(input, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(ifs),
+                     std::istreambuf_iterator<char>());
+}
+
+}  // namespace
+
+int batch(const std::string& dir, unsigned jobs,
+          const std::function<int(const std::string& path, std::ostream& err)>&
+              run) {
+  std::vector<std::string> paths;
+  std::error_code ec;
+  for (std::filesystem::directory_iterator it(dir, ec), end;
+       !ec && it != end; it.increment(ec)) {
+    if (it->path().extension() == ".pas" && it->is_regular_file()) {
+      paths.push_back(it->path().string());
+    }
+  }
+  if (ec) {
+    std::cerr << "can't read the directory '" << dir << "'." << std::endl;
+    return -1;
+  }
+  std::sort(paths.begin(), paths.end());
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<Result> results(paths.size());
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::atomic<size_t> next{0};
+
+  // Each thread takes the next program; a failing program only fails its
+  // own result
+  auto work = [&]() {
+    for (size_t i; (i = next++) < paths.size();) {
+      Result result;
+      std::ostringstream err;
+      auto input = read_input(paths[i]);
+      set_input(input);
+      capture_output(&result.out);
+      try {
+        result.status = run(paths[i], err);
+      } catch (const std::exception& e) {
+        err << e.what() << std::endl;
+        result.status = -1;
+      }
+      capture_output(nullptr);
+      result.err = err.str();
+      result.done = true;
+
+      std::lock_guard<std::mutex> lock(mutex);
+      results[i] = std::move(result);
+      ready.notify_one();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (auto job = 0u; job < std::max(jobs, 1u); job++) {
+    threads.emplace_back(work);
+  }
+
+  // Print in order while later programs are still running
+  auto status = 0;
+  size_t failed = 0;
+  for (size_t i = 0; i < paths.size(); i++) {
+    Result result;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      ready.wait(lock, [&] { return results[i].done; });
+      result = std::move(results[i]);
+    }
+    std::cout << "==> " << paths[i] << " <==\n" << result.out << std::flush;
+    std::cerr << result.err << std::flush;
+    if (result.status || !result.err.empty()) {
+      failed++;
+    }
+    if (result.status) {
+      status = 1;
+    }
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::fprintf(stderr,
+               "batch: %zu programs, %zu with errors, %.3fs (%.1f "
+               "programs/s)\n",
+               paths.size(), failed, elapsed.count(),
+               elapsed.count() > 0 ? paths.size() / elapsed.count() : 0.0);
+  return status;
+}
+
+}  // namespace pl0
@@ -0,0 +1,110 @@
+#include "server.h"
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace pl0 {
+
+static bool write_all(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    auto n = ::write(fd, data, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    data += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+int client(const std::string& path, int argc, const char** argv) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "the socket path is too long." << std::endl;
+    return -1;
+  }
+  std::strcpy(addr.sun_path, path.c_str());
+
+  auto fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 ||
+      connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+    std::cerr << "can't connect to the server '" << path
+              << "': " << std::strerror(errno) << std::endl;
+    return -1;
+  }
+
+  // Working directory and arguments
+  std::string payload;
+  char cwd[4096];
+  if (!getcwd(cwd, sizeof(cwd))) {
+    std::cerr << "can't get the working directory." << std::endl;
+    return -1;
+  }
+  payload.append(cwd).push_back('\0');
+  for (auto i = 0; i < argc; i++) {
+    payload.append(argv[i]).push_back('\0');
+  }
+
+  // The length goes with the standard descriptors
+  uint32_t length = static_cast<uint32_t>(payload.size());
+  iovec iov{&length, sizeof(length)};
+  int fds[] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  auto cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  if (sendmsg(fd, &msg, 0) != sizeof(length) ||
+      !write_all(fd, payload.data(), payload.size())) {
+    std::cerr << "can't send the request: " << std::strerror(errno)
+              << std::endl;
+    return -1;
+  }
+
+  // The program writes to our descriptors; wait for its exit status
+  int32_t status = 0;
+  size_t got = 0;
+  while (got < sizeof(status)) {
+    auto n = ::read(fd, reinterpret_cast<char*>(&status) + got,
+                    sizeof(status) - got);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      std::cerr << "the server closed the connection." << std::endl;
+      return -1;
+    }
+    got += static_cast<size_t>(n);
+  }
+  close(fd);
+  return status;
+}
+
+}  // namespace pl0
+
+#ifdef PL0_CLIENT_MAIN
+// pl0-client SOCKET [options] file: same as `pl0 --client` without loading
+// LLVM
+int main(int argc, const char** argv) {
+  if (argc < 2) {
+    std::cout << "usage: pl0-client socket [options] file" << std::endl;
+    return 1;
+  }
+  return pl0::client(argv[1], argc - 2, argv + 2);
+}
+#endif
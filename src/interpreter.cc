@@ -0,0 +1,490 @@
+#include "interpreter.h"
+#include "jit_compiler.h"
+#include "runtime.h"
+#include "stats.h"
+#include <algorithm>
+
+namespace pl0 {
+
+// Frame and free variable pointer stacks (in elements)
+static constexpr size_t kStackSize = 1 << 22;
+static constexpr size_t kArgsSize = 1 << 20;
+
+namespace {
+
+// Restores a stack pointer when a frame is left, also by an exception
+template <typename T>
+struct Restore {
+  T& ref;
+  T saved;
+  ~Restore() { ref = saved; }
+};
+
+inline int32_t wrap(uint32_t value) { return static_cast<int32_t>(value); }
+
+// Checked array index (negative indices are out of range too)
+inline uint32_t element(int32_t index, int32_t size) {
+  if (static_cast<uint32_t>(index) >= static_cast<uint32_t>(size)) {
+    throw "index out of range";
+  }
+  return static_cast<uint32_t>(index);
+}
+
+}  // namespace
+
+void Interpreter::run(const Program& program, const Options& options) {
+  Interpreter interp(program, options);
+  Stats::Phase phase("execute");
+  try {
+    interp.execute(interp.procs_[0], nullptr);
+  } catch (const char* msg) {
+    // Same report as the landing pad of the JIT compiled `main`
+    __pl0_print_error(msg);
+    return;
+  } catch (...) {
+    __pl0_flush();
+    throw;
+  }
+  __pl0_flush();
+}
+
+Interpreter::Interpreter(const Program& program, const Options& options)
+    : options_(options), program_(program) {
+  if (options.mode == Mode::tiered) {
+    threshold_ = std::max(options.hot_threshold, 1u);
+  }
+
+  stack_.reset(new int32_t[kStackSize]);
+  stack_top_ = stack_.get();
+  stack_end_ = stack_top_ + kStackSize;
+  args_.reset(new int32_t*[kArgsSize]);
+  args_top_ = args_.get();
+  args_end_ = args_top_ + kArgsSize;
+
+  Stats::Phase phase("bytecode");
+  refs_.resize(program.decls.size());
+  compile_block(0);
+}
+
+Interpreter::~Interpreter() = default;
+
+size_t Interpreter::compile_block(ir::Index index) {
+  // Procedures are numbered like the blocks they come from
+  const auto& block = program_.blocks[index];
+  procs_.emplace_back();
+
+  // Variables live in local slots, outer variables are reached through
+  // pointers in the same order as the JIT's arguments
+  {
+    auto& proc = procs_[index];
+    auto free = program_.list_of(block.free);
+    proc.free.assign(free, free + block.free.count);
+  }
+
+  for (auto i = 0u; i < block.procs.count; i++) {
+    compile_block(program_.list_of(block.procs)[i]);
+  }
+
+  auto prev_proc = proc_;
+  auto prev_depth = depth_;
+  proc_ = index;
+  depth_ = 0;
+
+  // Nested procedures are done, so the references can be reused
+  uint32_t locals = 0;
+  for (auto i = 0u; i < block.vars.count; i++) {
+    refs_[block.vars.first + i] = static_cast<Ref>(locals);
+    locals += std::max(program_.decls_of(block.vars)[i].size, 1u);
+  }
+  procs_[index].locals = locals;
+  for (auto i = 0u; i < block.free.count; i++) {
+    refs_[program_.list_of(block.free)[i]] = ~static_cast<Ref>(i);
+  }
+
+  compile_statement(block.body);
+  emit(kReturn, 0);
+
+  proc_ = prev_proc;
+  depth_ = prev_depth;
+  return index;
+}
+
+void Interpreter::compile_statement(ir::Index index) {
+  const auto& stmt = program_.stmts[index];
+  switch (stmt.kind) {
+    case ir::StmtKind::empty:
+      break;
+    case ir::StmtKind::assignment:
+      if (stmt.index != ir::kNone) {
+        compile_expression(stmt.index);
+        compile_expression(stmt.expr);
+        emit_element(kStoreElement, kStoreFreeElement, -2, stmt.target);
+        break;
+      }
+      compile_expression(stmt.expr);
+      emit_store(resolve(stmt.target));
+      break;
+    case ir::StmtKind::call: {
+      CallSite site;
+      site.proc = stmt.target;
+      for (auto free : procs_[site.proc].free) {
+        site.args.push_back(resolve(free));
+      }
+      emit(kCall, 0, static_cast<int32_t>(call_sites_.size()));
+      call_sites_.push_back(std::move(site));
+      break;
+    }
+    case ir::StmtKind::statements:
+      for (auto i = 0u; i < stmt.count; i++) {
+        compile_statement(program_.lists[stmt.first + i]);
+      }
+      break;
+    case ir::StmtKind::if_: {
+      compile_expression(stmt.expr);
+      auto end = emit(kJumpIfZero, -1, 0);
+      compile_statement(stmt.body);
+      procs_[proc_].code[end].value =
+          static_cast<int32_t>(procs_[proc_].code.size());
+      break;
+    }
+    case ir::StmtKind::while_: {
+      auto cond = static_cast<int32_t>(procs_[proc_].code.size());
+      compile_expression(stmt.expr);
+      auto end = emit(kJumpIfZero, -1, 0);
+      compile_statement(stmt.body);
+      emit(kLoop, 0, cond);
+      procs_[proc_].code[end].value =
+          static_cast<int32_t>(procs_[proc_].code.size());
+      break;
+    }
+    case ir::StmtKind::out:
+      compile_expression(stmt.expr);
+      emit(kOut, -1);
+      break;
+    case ir::StmtKind::in:
+      if (stmt.index != ir::kNone) {
+        compile_expression(stmt.index);
+        emit(kIn, 1);
+        emit_element(kStoreElement, kStoreFreeElement, -2, stmt.target);
+        break;
+      }
+      emit(kIn, 1);
+      emit_store(resolve(stmt.target));
+      break;
+  }
+}
+
+void Interpreter::compile_expression(ir::Index index) {
+  const auto& expr = program_.exprs[index];
+  switch (expr.kind) {
+    case ir::ExprKind::number:
+      emit(kPush, 1, expr.value);
+      return;
+    case ir::ExprKind::variable: {
+      auto ref = resolve(expr.decl);
+      if (ref >= 0) {
+        emit(kLoad, 1, ref);
+      } else {
+        emit(kLoadFree, 1, ~ref);
+      }
+      return;
+    }
+    case ir::ExprKind::element:
+      compile_expression(expr.lhs);
+      emit_element(kLoadElement, kLoadFreeElement, 0, expr.decl);
+      return;
+    case ir::ExprKind::neg:
+      compile_expression(expr.lhs);
+      emit(kNeg, 0);
+      return;
+    case ir::ExprKind::odd:
+      // Same semantics as JITCompiler::compile_condition
+      compile_expression(expr.lhs);
+      emit(kOdd, 0);
+      return;
+    default:
+      break;
+  }
+
+  compile_expression(expr.lhs);
+  compile_expression(expr.rhs);
+  switch (expr.kind) {
+    case ir::ExprKind::add:
+      emit(kAdd, -1);
+      break;
+    case ir::ExprKind::sub:
+      emit(kSub, -1);
+      break;
+    case ir::ExprKind::mul:
+      emit(kMul, -1);
+      break;
+    case ir::ExprKind::div:
+    case ir::ExprKind::div_nonzero:
+      emit(kDiv, -1);
+      break;
+    case ir::ExprKind::eq:
+      emit(kEq, -1);
+      break;
+    case ir::ExprKind::ne:
+      emit(kNe, -1);
+      break;
+    case ir::ExprKind::lt:
+      emit(kLt, -1);
+      break;
+    case ir::ExprKind::le:
+      emit(kLe, -1);
+      break;
+    case ir::ExprKind::gt:
+      emit(kGt, -1);
+      break;
+    default:
+      emit(kGe, -1);
+      break;
+  }
+}
+
+void Interpreter::emit(Op op, int delta) {
+  auto& proc = procs_[proc_];
+  Slot slot;
+  slot.value = op;
+  proc.code.push_back(slot);
+  depth_ += delta;
+  proc.max_stack = std::max(proc.max_stack, depth_);
+}
+
+size_t Interpreter::emit(Op op, int delta, int32_t operand) {
+  emit(op, delta);
+  Slot slot;
+  slot.value = operand;
+  procs_[proc_].code.push_back(slot);
+  return procs_[proc_].code.size() - 1;
+}
+
+void Interpreter::emit_store(Ref ref) {
+  if (ref >= 0) {
+    emit(kStore, -1, ref);
+  } else {
+    emit(kStoreFree, -1, ~ref);
+  }
+}
+
+void Interpreter::emit_element(Op local, Op free, int delta,
+                               ir::Index decl) {
+  auto ref = resolve(decl);
+  emit(ref >= 0 ? local : free, delta, ref >= 0 ? ref : ~ref);
+  Slot slot;
+  slot.value = static_cast<int32_t>(program_.decls[decl].size);
+  procs_[proc_].code.push_back(slot);
+}
+
+void Interpreter::execute(Proc& proc, int32_t** free) {
+  // Indexed by Op
+  static const void* const labels[] = {
+      &&push, &&load, &&store, &&load_free, &&store_free,
+      &&load_element, &&store_element, &&load_free_element,
+      &&store_free_element, &&neg, &&add, &&sub, &&mul, &&div, &&odd, &&eq,
+      &&ne, &&lt, &&le, &&gt, &&ge, &&jump, &&jump_if_zero, &&loop, &&call,
+      &&out, &&in, &&ret,
+  };
+
+  // Direct threading: opcodes are replaced by their handler addresses
+  if (!proc.threaded) {
+    for (auto i = 0u; i < proc.code.size(); i++) {
+      auto op = static_cast<Op>(proc.code[i].value);
+      proc.code[i].label = labels[op];
+      switch (op) {
+        case kPush:
+        case kLoad:
+        case kStore:
+        case kLoadFree:
+        case kStoreFree:
+        case kJump:
+        case kJumpIfZero:
+        case kLoop:
+        case kCall:
+          i++;  // operand
+          break;
+        case kLoadElement:
+        case kStoreElement:
+        case kLoadFreeElement:
+        case kStoreFreeElement:
+          i += 2;  // reference, size
+          break;
+        default:
+          break;
+      }
+    }
+    proc.threaded = true;
+  }
+
+  auto size = proc.locals + proc.max_stack;
+  if (size > static_cast<size_t>(stack_end_ - stack_top_)) {
+    throw "stack overflow";
+  }
+  auto locals = stack_top_;
+  Restore<int32_t*> frame{stack_top_, locals};
+  stack_top_ += size;
+  std::fill(locals, locals + proc.locals, 0);
+
+  auto sp = locals + proc.locals;
+  auto code = proc.code.data();
+  auto pc = code;
+
+#define NEXT() goto *(pc++)->label
+
+  NEXT();
+
+push:
+  *sp++ = (pc++)->value;
+  NEXT();
+load:
+  *sp++ = locals[(pc++)->value];
+  NEXT();
+store:
+  locals[(pc++)->value] = *--sp;
+  NEXT();
+load_free:
+  *sp++ = *free[(pc++)->value];
+  NEXT();
+store_free:
+  *free[(pc++)->value] = *--sp;
+  NEXT();
+load_element:
+  sp[-1] = locals[pc[0].value + element(sp[-1], pc[1].value)];
+  pc += 2;
+  NEXT();
+store_element:
+  sp -= 2;
+  locals[pc[0].value + element(sp[0], pc[1].value)] = sp[1];
+  pc += 2;
+  NEXT();
+load_free_element:
+  sp[-1] = free[pc[0].value][element(sp[-1], pc[1].value)];
+  pc += 2;
+  NEXT();
+store_free_element:
+  sp -= 2;
+  free[pc[0].value][element(sp[0], pc[1].value)] = sp[1];
+  pc += 2;
+  NEXT();
+neg:
+  sp[-1] = wrap(0u - static_cast<uint32_t>(sp[-1]));
+  NEXT();
+add:
+  sp--;
+  sp[-1] = wrap(static_cast<uint32_t>(sp[-1]) + static_cast<uint32_t>(*sp));
+  NEXT();
+sub:
+  sp--;
+  sp[-1] = wrap(static_cast<uint32_t>(sp[-1]) - static_cast<uint32_t>(*sp));
+  NEXT();
+mul:
+  sp--;
+  sp[-1] = wrap(static_cast<uint32_t>(sp[-1]) * static_cast<uint32_t>(*sp));
+  NEXT();
+div:
+  sp--;
+  if (*sp == 0) {
+    throw "divide by 0";
+  }
+  sp[-1] = sp[-1] / *sp;
+  NEXT();
+odd:
+  sp[-1] = sp[-1] != 0;
+  NEXT();
+eq:
+  sp--;
+  sp[-1] = sp[-1] == *sp;
+  NEXT();
+ne:
+  sp--;
+  sp[-1] = sp[-1] != *sp;
+  NEXT();
+lt:
+  sp--;
+  sp[-1] = sp[-1] < *sp;
+  NEXT();
+le:
+  sp--;
+  sp[-1] = sp[-1] <= *sp;
+  NEXT();
+gt:
+  sp--;
+  sp[-1] = sp[-1] > *sp;
+  NEXT();
+ge:
+  sp--;
+  sp[-1] = sp[-1] >= *sp;
+  NEXT();
+jump:
+  pc = code + pc->value;
+  NEXT();
+jump_if_zero : {
+  auto target = (pc++)->value;
+  if (!*--sp) {
+    pc = code + target;
+  }
+  NEXT();
+}
+loop:
+  pc = code + pc->value;
+  if (threshold_ && ++proc.heat == threshold_) {
+    promote(proc);
+  }
+  NEXT();
+call:
+  call(call_sites_[(pc++)->value], locals, free);
+  NEXT();
+out:
+  __pl0_out(*--sp);
+  NEXT();
+in:
+  *sp++ = __pl0_in();
+  NEXT();
+ret:
+  return;
+
+#undef NEXT
+}
+
+void Interpreter::call(const CallSite& site, int32_t* locals,
+                       int32_t** free) {
+  auto& callee = procs_[site.proc];
+
+  auto n = site.args.size();
+  if (n > static_cast<size_t>(args_end_ - args_top_)) {
+    throw "stack overflow";
+  }
+  auto args = args_top_;
+  Restore<int32_t**> frame{args_top_, args};
+  args_top_ += n;
+  for (auto i = 0u; i < n; i++) {
+    auto ref = site.args[i];
+    args[i] = ref >= 0 ? &locals[ref] : free[~ref];
+  }
+
+  if (threshold_ && !callee.entry && ++callee.heat == threshold_) {
+    promote(callee);
+  }
+  if (callee.entry) {
+    callee.entry(args);
+  } else {
+    execute(callee, args);
+  }
+}
+
+void Interpreter::promote(Proc& proc) {
+  // The main block runs once, so there is nothing to call natively
+  if (proc.promoted || &proc == &procs_[0]) {
+    return;
+  }
+  proc.promoted = true;
+
+  if (!jit_) {
+    jit_ = JITCompiler::load(program_, options_);
+  }
+  proc.entry = reinterpret_cast<void (*)(int32_t**)>(
+      jit_->entry(static_cast<ir::Index>(&proc - procs_.data())));
+}
+
+}  // namespace pl0
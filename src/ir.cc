@@ -0,0 +1,289 @@
+#include "ir.h"
+#include "utils.h"
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace pl0 {
+
+using namespace peg::udl;
+using namespace ir;
+
+namespace {
+
+// Walks the AST once, appending nodes to the program. Identifiers are
+// interned by their token, which points into the source.
+class Lowering {
+ public:
+  Lowering(Program& program) : program_(program) {}
+
+  Index block(const AstPL0& ast, Name name, Index outer, Location loc) {
+    auto index = static_cast<Index>(program_.blocks.size());
+    // The ranges and the body are filled in below, the rest by the analyses
+    Block entry{};
+    entry.name = name;
+    entry.outer = outer;
+    entry.body = kNone;
+    entry.loc = loc;
+    program_.blocks.push_back(entry);
+
+    const auto& consts = ast.nodes[0]->nodes;
+    Range range{static_cast<Index>(program_.decls.size()), 0};
+    for (auto i = 0u; i < consts.size(); i += 2) {
+      program_.decls.push_back({intern(consts[i]->token),
+                                consts[i + 1]->token_to_number<int>(), 0,
+                                index, location(*consts[i])});
+      range.count++;
+    }
+    program_.blocks[index].consts = range;
+
+    range = {static_cast<Index>(program_.decls.size()), 0};
+    for (const auto& node : ast.nodes[1]->nodes) {
+      const auto& ident = *node->nodes[0];
+      uint32_t size = 0;
+      if (node->nodes.size() > 1) {
+        size = array_size(*node->nodes[1]);
+      }
+      program_.decls.push_back(
+          {intern(ident.token), 0, size, index, location(ident)});
+      range.count++;
+    }
+    program_.blocks[index].vars = range;
+
+    const auto& procs = ast.nodes[2]->nodes;
+    std::vector<Index> inner;
+    for (auto i = 0u; i < procs.size(); i += 2) {
+      inner.push_back(block(*procs[i + 1], intern(procs[i]->token), index,
+                            location(*procs[i])));
+    }
+    program_.blocks[index].procs = list(inner);
+
+    auto body = statement(*ast.nodes[3]);
+    program_.blocks[index].body = body;
+    return index;
+  }
+
+ private:
+  Program& program_;
+  std::unordered_map<std::string_view, Name> interned_;
+
+  Name intern(std::string_view token) {
+    auto it = interned_.find(token);
+    if (it != interned_.end()) {
+      return it->second;
+    }
+    auto name = static_cast<Name>(program_.names.size());
+    program_.names.emplace_back(token);
+    interned_.emplace(token, name);
+    return name;
+  }
+
+  static Location location(const AstPL0& ast) {
+    return {static_cast<uint32_t>(ast.line), static_cast<uint32_t>(ast.column)};
+  }
+
+  uint32_t array_size(const AstPL0& ast) const {
+    uint64_t size = 0;
+    for (auto c : ast.token) {
+      size = std::min<uint64_t>(size * 10 + static_cast<uint64_t>(c - '0'),
+                                kMaxArraySize + 1);
+    }
+    if (size == 0 || size > kMaxArraySize) {
+      throw_runtime_error(program_, location(ast),
+                          "the size of an array must be 1 to " +
+                              std::to_string(kMaxArraySize) + "...");
+    }
+    return static_cast<uint32_t>(size);
+  }
+
+  Range list(const std::vector<Index>& indices) {
+    Range range{static_cast<Index>(program_.lists.size()),
+                static_cast<uint32_t>(indices.size())};
+    program_.lists.insert(program_.lists.end(), indices.begin(),
+                          indices.end());
+    return range;
+  }
+
+  Index stmt(Stmt node) {
+    program_.stmts.push_back(node);
+    return static_cast<Index>(program_.stmts.size() - 1);
+  }
+
+  Index expr(Expr node) {
+    program_.exprs.push_back(node);
+    return static_cast<Index>(program_.exprs.size() - 1);
+  }
+
+  Index statement(const AstPL0& ast) {
+    Stmt node{StmtKind::empty, 0, kNone, kNone, kNone, 0, 0, kNone,
+              location(ast)};
+    if (ast.nodes.empty()) {
+      return stmt(node);
+    }
+
+    const auto& inner = *ast.nodes[0];
+    const auto& nodes = inner.nodes;
+    node.loc = location(inner);
+    switch (inner.tag) {
+      case "assignment"_:
+        node.kind = StmtKind::assignment;
+        target(*nodes[0], node);
+        node.expr = expression(*nodes[1]);
+        break;
+      case "call"_:
+        node.kind = StmtKind::call;
+        node.name = intern(nodes[0]->token);
+        node.loc = location(*nodes[0]);
+        break;
+      case "statements"_: {
+        std::vector<Index> stmts;
+        for (const auto& child : nodes) {
+          stmts.push_back(statement(*child));
+        }
+        auto range = list(stmts);
+        node.kind = StmtKind::statements;
+        node.first = range.first;
+        node.count = range.count;
+        break;
+      }
+      case "if"_:
+        node.kind = StmtKind::if_;
+        node.expr = condition(*nodes[0]);
+        node.body = statement(*nodes[1]);
+        break;
+      case "while"_:
+        node.kind = StmtKind::while_;
+        node.expr = condition(*nodes[0]);
+        node.body = statement(*nodes[1]);
+        break;
+      case "out"_:
+        node.kind = StmtKind::out;
+        node.expr = expression(*nodes[0]);
+        break;
+      case "in"_:
+        node.kind = StmtKind::in;
+        target(*nodes[0], node);
+        break;
+    }
+    return stmt(node);
+  }
+
+  // Variable or array element written by an assignment or `in`
+  void target(const AstPL0& ast, Stmt& node) {
+    if (ast.tag == "element"_) {
+      node.name = intern(ast.nodes[0]->token);
+      node.loc = location(*ast.nodes[0]);
+      node.index = expression(*ast.nodes[1]);
+    } else {
+      node.name = intern(ast.token);
+      node.loc = location(ast);
+    }
+  }
+
+  Index condition(const AstPL0& ast) {
+    const auto& cond = *ast.nodes[0];
+    const auto& nodes = cond.nodes;
+    if (cond.tag == "odd"_) {
+      return expr({ExprKind::odd, 0, 0, kNone, expression(*nodes[0]), kNone,
+                   location(cond)});
+    }
+
+    auto lhs = expression(*nodes[0]);
+    auto rhs = expression(*nodes[2]);
+
+    auto ope = nodes[1]->token;
+    ExprKind kind = ExprKind::eq;
+    switch (ope[0]) {
+      case '=':
+        kind = ExprKind::eq;
+        break;
+      case '#':
+        kind = ExprKind::ne;
+        break;
+      case '<':
+        kind = ope.size() == 1 ? ExprKind::lt : ExprKind::le;
+        break;
+      case '>':
+        kind = ope.size() == 1 ? ExprKind::gt : ExprKind::ge;
+        break;
+    }
+    return expr({kind, 0, 0, kNone, lhs, rhs, location(cond)});
+  }
+
+  Index expression(const AstPL0& ast) {
+    const auto& nodes = ast.nodes;
+
+    auto sign = nodes[0]->token;
+    auto negative = !(sign.empty() || sign == "+");
+
+    auto val = term(*nodes[1]);
+    if (negative) {
+      val = expr({ExprKind::neg, 0, 0, kNone, val, kNone, location(ast)});
+    }
+
+    for (auto i = 2u; i < nodes.size(); i += 2) {
+      auto ope = nodes[i + 0]->token[0];
+      auto rval = term(*nodes[i + 1]);
+      val = expr({ope == '+' ? ExprKind::add : ExprKind::sub, 0, 0, kNone, val,
+                  rval, location(*nodes[i])});
+    }
+    return val;
+  }
+
+  Index term(const AstPL0& ast) {
+    const auto& nodes = ast.nodes;
+    auto val = factor(*nodes[0]);
+    for (auto i = 1u; i < nodes.size(); i += 2) {
+      auto ope = nodes[i + 0]->token[0];
+      auto rval = factor(*nodes[i + 1]);
+      val = expr({ope == '*' ? ExprKind::mul : ExprKind::div, 0, 0, kNone, val,
+                  rval, location(*nodes[i])});
+    }
+    return val;
+  }
+
+  Index factor(const AstPL0& ast) {
+    const auto& node = *ast.nodes[0];
+    switch (node.tag) {
+      case "ident"_:
+        return expr({ExprKind::variable, 0, intern(node.token), kNone, kNone,
+                     kNone, location(node)});
+      case "element"_: {
+        auto index = expression(*node.nodes[1]);
+        return expr({ExprKind::element, 0, intern(node.nodes[0]->token),
+                     kNone, index, kNone, location(*node.nodes[0])});
+      }
+      case "number"_: {
+        // Decimal literals wrap to 32 bits
+        uint32_t value = 0;
+        for (auto c : node.token) {
+          value = value * 10 + static_cast<uint32_t>(c - '0');
+        }
+        return expr({ExprKind::number, static_cast<int32_t>(value), 0, kNone,
+                     kNone, kNone, location(node)});
+      }
+      default:
+        return expression(node);
+    }
+  }
+};
+
+}  // namespace
+
+Program Program::lower(const AstPL0& ast) {
+  Program program;
+  program.path = ast.path;
+  Lowering(program).block(*ast.nodes[0], kNone, kNone, {});
+  // The main block is located by its body, which doesn't move when a
+  // procedure is edited
+  program.blocks[0].loc = program.stmts[program.blocks[0].body].loc;
+  return program;
+}
+
+void throw_runtime_error(const Program& program, Location loc,
+                         const std::string& msg) {
+  throw std::runtime_error(
+      format_error_message(program.path, loc.line, loc.column, msg));
+}
+
+}  // namespace pl0
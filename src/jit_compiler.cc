@@ -1,24 +1,164 @@
 #include "jit_compiler.h"
-#include "llvm/ExecutionEngine/ExecutionEngine.h"
-#include "llvm/ExecutionEngine/GenericValue.h"
-#include "llvm/ExecutionEngine/MCJIT.h"
-#include "llvm/IR/ValueSymbolTable.h"
+#include "object_cache.h"
+#include "runtime.h"
+#include "stats.h"
+#include "utils.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/JITEventListener.h"
+#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/Program.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Scalar/InductiveRangeCheckElimination.h"
+#include "llvm/Transforms/Scalar/LoopPassManager.h"
+#include "llvm/Transforms/Scalar/LoopRotation.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
 
 namespace pl0 {
 
-using namespace peg::udl;
 using namespace llvm;
 
-void JITCompiler::run(const std::shared_ptr<AstPL0> ast) {
-  JITCompiler jit;
-  jit.compile(ast);
+template <typename T>
+static T check(Expected<T> value) {
+  if (!value) {
+    throw std::runtime_error(toString(value.takeError()));
+  }
+  return std::move(*value);
+}
+
+static void check(Error err) {
+  if (err) {
+    throw std::runtime_error(toString(std::move(err)));
+  }
+}
+
+void JITCompiler::run(Program program, const Options& options,
+                      ObjectFileCache* cache,
+                      const std::string& key) {
+  JITCompiler jit(options);
+  if (cache) {
+    jit.cache_ = cache;
+    jit.module_->setModuleIdentifier(key);
+  }
+  jit.compile(program);
+
+  // Code generation only needs the IR
+  program = Program();
+  jit.program_ = nullptr;
   jit.exec();
-  // jit.dump();
 }
 
-JITCompiler::JITCompiler() : builder_(context_) {
+void JITCompiler::run(std::unique_ptr<MemoryBuffer> object,
+                      const Options& options) {
+  initialize();
+
+  auto jit =
+      check(orc::LLJITBuilder()
+                .setJITTargetMachineBuilder(target_machine_builder(options))
+                .setObjectLinkingLayerCreator(object_layer(options))
+                .create());
+  check(jit->addObjectFile(std::move(object)));
+  define_runtime(*jit);
+  run_main(*jit);
+}
+
+std::unique_ptr<JITCompiler> JITCompiler::load(const Program& program,
+                                               const Options& options) {
+  std::unique_ptr<JITCompiler> jit(new JITCompiler(options));
+  jit->entries_ = true;
+  // The adapters pass free variables the way the interpreter keeps them
+  jit->options_.frames = false;
+  // Errors are caught by the interpreter, which doesn't count fuel
+  jit->options_.fast_fail = false;
+  jit->options_.fuel = 0;
+  jit->options_.memo = false;
+  jit->options_.profile = false;
+  jit->options_.profile_out.clear();
+  // Procedures are compiled as they get hot
+  jit->options_.jobs = 1;
+  jit->compile(program);
+  jit->create_jit();
+  return jit;
+}
+
+void* JITCompiler::entry(ir::Index block) {
+  return check(jit_->lookup(entry_symbols_[block])).toPtr<void*>();
+}
+
+void JITCompiler::emit(const Program& program, const Options& options) {
+  JITCompiler jit(options);
+  // Nothing would report the counters
+  jit.options_.profile = false;
+  jit.options_.profile_out.clear();
+  jit.compile(program);
+
+  if (!options.emit_llvm_pre.empty()) {
+    jit.dump(options.emit_llvm_pre);
+  }
+
+  jit.optimize(*jit.module_, *jit.tm_);
+
+  if (!options.emit_llvm.empty()) {
+    jit.dump(options.emit_llvm);
+  }
+  if (!options.emit_asm.empty()) {
+    jit.emit_file(options.emit_asm, CodeGenFileType::AssemblyFile);
+  }
+  if (!options.emit_obj.empty()) {
+    jit.emit_file(options.emit_obj, CodeGenFileType::ObjectFile);
+  }
+  if (!options.emit_exe.empty()) {
+    SmallString<128> obj;
+    if (auto ec = sys::fs::createTemporaryFile("pl0", "o", obj)) {
+      throw std::runtime_error("can't create a temporary file: " +
+                               ec.message());
+    }
+    jit.emit_file(std::string(obj), CodeGenFileType::ObjectFile);
+    try {
+      jit.link(std::string(obj), options.emit_exe);
+    } catch (...) {
+      sys::fs::remove(obj);
+      throw;
+    }
+    sys::fs::remove(obj);
+  }
+}
+
+void JITCompiler::initialize() {
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+}
+
+JITCompiler::JITCompiler(const Options& options)
+    : options_(options),
+      tsctx_(std::make_unique<LLVMContext>()),
+      context_(*tsctx_.getContext()),
+      builder_(context_) {
   module_ = std::make_unique<Module>("pl0", context_);
 
   tyinfo_ =
@@ -26,111 +166,658 @@ JITCompiler::JITCompiler() : builder_(context_) {
                          GlobalValue::ExternalLinkage, nullptr, "_ZTIPKc");
 }
 
-void JITCompiler::compile(const std::shared_ptr<AstPL0> ast) {
-  InitializeNativeTarget();
-  InitializeNativeTargetAsmPrinter();
+// Size of the code sections of an object file
+static uint64_t text_size(MemoryBufferRef object) {
+  auto file = object::ObjectFile::createObjectFile(object);
+  if (!file) {
+    consumeError(file.takeError());
+    return 0;
+  }
+  uint64_t size = 0;
+  for (const auto& section : (*file)->sections()) {
+    if (section.isText()) {
+      size += section.getSize();
+    }
+  }
+  return size;
+}
+
+// Times code generation and counts the machine code it produces
+class TimedCompiler : public orc::IRCompileLayer::IRCompiler {
+ public:
+  TimedCompiler(std::unique_ptr<IRCompiler> compiler)
+      : IRCompiler(compiler->getManglingOptions()),
+        compiler_(std::move(compiler)) {}
+
+  Expected<std::unique_ptr<MemoryBuffer>> operator()(Module& module) override {
+    Stats::Phase phase("codegen");
+    auto object = (*compiler_)(module);
+    if (object) {
+      Stats::count("machine code bytes", text_size(**object));
+    }
+    return object;
+  }
+
+ private:
+  std::unique_ptr<IRCompiler> compiler_;
+};
+
+static CodeGenOptLevel codegen_opt_level(unsigned opt_level) {
+  switch (opt_level) {
+    case 0:
+      return CodeGenOptLevel::None;
+    case 1:
+      return CodeGenOptLevel::Less;
+    case 2:
+      return CodeGenOptLevel::Default;
+    default:
+      return CodeGenOptLevel::Aggressive;
+  }
+}
+
+static OptimizationLevel ir_opt_level(unsigned opt_level) {
+  switch (opt_level) {
+    case 0:
+      return OptimizationLevel::O0;
+    case 1:
+      return OptimizationLevel::O1;
+    case 2:
+      return OptimizationLevel::O2;
+    default:
+      return OptimizationLevel::O3;
+  }
+}
+
+// Appends the functions of each loaded object to /tmp/perf-<pid>.map
+// (--perf-map), the file `perf report` reads to name samples in JIT code
+class PerfMapListener : public JITEventListener {
+ public:
+  PerfMapListener() {
+    auto path = "/tmp/perf-" + std::to_string(sys::Process::getProcessId()) +
+                ".map";
+    std::error_code ec;
+    os_ = std::make_unique<raw_fd_ostream>(path, ec, sys::fs::OF_Append);
+    if (ec) {
+      throw std::runtime_error("can't open '" + path + "': " + ec.message());
+    }
+  }
+
+  void notifyObjectLoaded(ObjectKey,
+                          const object::ObjectFile& object,
+                          const RuntimeDyld::LoadedObjectInfo& info) override {
+    // A copy of the object with its sections at their load addresses
+    auto debug = info.getObjectForDebug(object);
+    const auto& loaded = debug.getBinary() ? *debug.getBinary() : object;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& [symbol, size] : object::computeSymbolSizes(loaded)) {
+      auto type = symbol.getType();
+      if (!type) {
+        consumeError(type.takeError());
+        continue;
+      }
+      auto name = symbol.getName();
+      if (!name) {
+        consumeError(name.takeError());
+        continue;
+      }
+      auto address = symbol.getAddress();
+      if (!address) {
+        consumeError(address.takeError());
+        continue;
+      }
+      if (*type == object::SymbolRef::ST_Function && size) {
+        *os_ << format("%llx %llx ", static_cast<unsigned long long>(*address),
+                       static_cast<unsigned long long>(size))
+             << *name << "\n";
+      }
+    }
+    os_->flush();
+  }
+
+ private:
+  std::mutex mutex_;
+  std::unique_ptr<raw_fd_ostream> os_;
+};
+
+orc::LLJITBuilderState::ObjectLinkingLayerCreator JITCompiler::object_layer(
+    const Options& options) {
+  if (!options.perf_map && !options.jitdump && !options.gdb) {
+    return nullptr;
+  }
+
+  // The listeners live as long as the process
+  std::vector<JITEventListener*> listeners;
+  if (options.perf_map) {
+    // Shared by the JITs of a batch
+    static auto perf_map = std::make_unique<PerfMapListener>();
+    listeners.push_back(perf_map.get());
+  }
+  if (options.jitdump) {
+    auto jitdump = JITEventListener::createPerfJITEventListener();
+    if (!jitdump) {
+      throw std::runtime_error("LLVM was built without perf support...");
+    }
+    listeners.push_back(jitdump);
+  }
+  if (options.gdb) {
+    listeners.push_back(JITEventListener::createGDBRegistrationListener());
+  }
+
+  // RuntimeDyld tells the listeners where each object gets loaded
+  return [listeners](orc::ExecutionSession& es, const Triple&)
+             -> Expected<std::unique_ptr<orc::ObjectLayer>> {
+    auto layer = std::make_unique<orc::RTDyldObjectLinkingLayer>(
+        es, [](const MemoryBuffer&) {
+          return std::make_unique<SectionMemoryManager>();
+        });
+    for (auto listener : listeners) {
+      layer->registerJITEventListener(*listener);
+    }
+    return layer;
+  };
+}
+
+orc::JITTargetMachineBuilder JITCompiler::target_machine_builder(
+    const Options& options) {
+  // Target machine for the host CPU and its features
+  auto jtmb = check(orc::JITTargetMachineBuilder::detectHost());
+  jtmb.setCodeGenOptLevel(codegen_opt_level(options.opt_level));
+  if (options.compile_only()) {
+    // Objects are linked into position independent executables
+    jtmb.setRelocationModel(Reloc::PIC_);
+  }
+  if (!options.profile_use.empty() && options.opt_level > 0) {
+    // Blocks that never ran in the profile move to a separate section (at
+    // -O0 the split code can't be unwound)
+    jtmb.getOptions().EnableMachineFunctionSplitter = true;
+  }
+  return jtmb;
+}
+
+void JITCompiler::compile(const Program& program) {
+  initialize();
+
+  tm_ = check(target_machine_builder(options_).createTargetMachine());
+
+  module_->setDataLayout(tm_->createDataLayout());
+  module_->setTargetTriple(tm_->getTargetTriple().str());
+
+  Stats::Phase phase("irgen");
+  program_ = &program;
+  values_.assign(program.decls.size(), nullptr);
+  functions_.assign(program.blocks.size(), nullptr);
+  entry_symbols_.assign(entries_ ? program.blocks.size() : 0, {});
+  arrays_ = std::any_of(program.decls.begin(), program.decls.end(),
+                        [](const ir::Decl& decl) { return decl.size; });
+  if (!options_.profile_use.empty()) {
+    profile_data_ = std::make_unique<ProfileData>(
+        ProfileData::load(options_.profile_use));
+    compile_profile_summary();
+  }
   compile_libs();
-  compile_program(ast);
+  compile_program();
+  Stats::count("ir instructions", module_->getInstructionCount());
+}
+
+void JITCompiler::optimize(Module& module, TargetMachine& tm) {
+  Stats::Phase phase("optimize");
+
+  // Partitions of the module don't keep the profile summary
+  if (profile_summary_ && !module.getProfileSummary(false)) {
+    module.setProfileSummary(profile_summary_->getMD(module.getContext()),
+                             ProfileSummary::PSK_Instr);
+  }
+
+  LoopAnalysisManager lam;
+  FunctionAnalysisManager fam;
+  CGSCCAnalysisManager cgam;
+  ModuleAnalysisManager mam;
+
+  PassBuilder pb(&tm);
+  pb.registerModuleAnalyses(mam);
+  pb.registerCGSCCAnalyses(cgam);
+  pb.registerFunctionAnalyses(fam);
+  pb.registerLoopAnalyses(lam);
+  pb.crossRegisterProxies(lam, fam, cgam, mam);
+
+  // Loops that index arrays are split into a main loop whose indices are
+  // known to be in range, without bounds checks, and pre/post loops that
+  // keep them (IRCE); only the main loop has to be free of checks to
+  // vectorize. This has to happen on rotated loops before IndVarSimplify
+  // turns the checks into exit tests, which IRCE doesn't recognize.
+  if (arrays_) {
+    pb.registerPeepholeEPCallback(
+        [](FunctionPassManager& fpm, OptimizationLevel) {
+          fpm.addPass(createFunctionToLoopPassAdaptor(LoopRotatePass()));
+          fpm.addPass(IRCEPass());
+        });
+  }
+
+  // O1 and above: mem2reg (SROA), instcombine, GVN, inlining, loop passes...
+  auto level = ir_opt_level(options_.opt_level);
+  auto mpm = level == OptimizationLevel::O0
+                 ? pb.buildO0DefaultPipeline(level)
+                 : pb.buildPerModuleDefaultPipeline(level);
+  mpm.run(module, mam);
+  Stats::count("optimized ir instructions", module.getInstructionCount());
 }
 
 void JITCompiler::exec() {
-  std::unique_ptr<ExecutionEngine> ee(
-      EngineBuilder(std::move(module_)).create());
-  auto ret = ee->runFunction(ee->FindFunctionNamed("main"), {});
+  create_jit();
+
+  // Unless procedures are compiled lazily, all of the code can be generated
+  // now, and then only the code and data sections of the JIT need to stay
+  if (!options_.lazy || options_.jobs > 1 || cache_) {
+    check(jit_->lookup("main"));
+    release();
+  }
+  run_main(*jit_);
 }
 
-void JITCompiler::dump() { module_->print(llvm::outs(), nullptr); }
+void JITCompiler::release() {
+  // The module is gone once it's compiled, which leaves the context. The
+  // builder still refers to it but isn't used any more.
+  module_.reset();
+  tsctx_ = orc::ThreadSafeContext();
+  tm_.reset();
+  values_ = {};
+  functions_ = {};
+  memo_tables_ = {};
+  profile_counters_ = {};
+  profile_data_.reset();
+  profile_summary_.reset();
+  trim_heap();
+}
 
-void JITCompiler::compile_switch(const std::shared_ptr<AstPL0> ast) {
-  switch (ast->tag) {
-    case "assignment"_:
-      compile_assignment(ast);
-      break;
-    case "call"_:
-      compile_call(ast);
-      break;
-    case "statements"_:
-      compile_statements(ast);
-      break;
-    case "if"_:
-      compile_if(ast);
-      break;
-    case "while"_:
-      compile_while(ast);
-      break;
-    case "out"_:
-      compile_out(ast);
-      break;
-    default:
-      compile_switch(ast->nodes[0]);
-      break;
+void JITCompiler::create_jit() {
+  // With a cache, the compiler hands the object to it
+  auto compiler = [this](orc::JITTargetMachineBuilder jtmb)
+      -> Expected<std::unique_ptr<orc::IRCompileLayer::IRCompiler>> {
+    auto tm = jtmb.createTargetMachine();
+    if (!tm) {
+      return tm.takeError();
+    }
+    std::unique_ptr<orc::IRCompileLayer::IRCompiler> ir_compiler =
+        std::make_unique<orc::TMOwningSimpleCompiler>(std::move(*tm), cache_);
+    if (Stats::enabled()) {
+      ir_compiler = std::make_unique<TimedCompiler>(std::move(ir_compiler));
+    }
+    return ir_compiler;
+  };
+
+  std::unique_ptr<orc::LLJIT> jit;
+  if (options_.jobs > 1 && !cache_) {
+    auto objects = compile_parallel();
+
+    // The partitions' objects link against each other in one JITDylib
+    jit = check(orc::LLJITBuilder()
+                    .setJITTargetMachineBuilder(target_machine_builder(options_))
+                    .setObjectLinkingLayerCreator(object_layer(options_))
+                    .create());
+    for (auto& object : objects) {
+      check(jit->addObjectFile(std::move(object)));
+    }
+  } else if (options_.lazy && !cache_) {
+    // Each procedure is split into its own partition and code-generated
+    // through a lazy re-export stub on its first `CALL`
+    auto lazy = check(orc::LLLazyJITBuilder()
+                          .setJITTargetMachineBuilder(
+                              target_machine_builder(options_))
+                          .setObjectLinkingLayerCreator(object_layer(options_))
+                          .setCompileFunctionCreator(compiler)
+                          .create());
+    lazy->setPartitionFunction(orc::CompileOnDemandLayer::compileRequested);
+
+    // Partitions are optimized when they get materialized, so cold
+    // procedures cost neither IR passes nor codegen
+    lazy->getIRTransformLayer().setTransform(
+        [this](orc::ThreadSafeModule tsm,
+               orc::MaterializationResponsibility&)
+            -> Expected<orc::ThreadSafeModule> {
+          tsm.withModuleDo(
+              [this](Module& module) { optimize(module, *tm_); });
+          return tsm;
+        });
+
+    check(lazy->addLazyIRModule(
+        orc::ThreadSafeModule(std::move(module_), tsctx_)));
+    jit = std::move(lazy);
+  } else {
+    optimize(*module_, *tm_);
+
+    // The whole module is compiled into a single object
+    jit = check(orc::LLJITBuilder()
+                    .setJITTargetMachineBuilder(target_machine_builder(options_))
+                    .setObjectLinkingLayerCreator(object_layer(options_))
+                    .setCompileFunctionCreator(compiler)
+                    .create());
+    check(jit->addIRModule(orc::ThreadSafeModule(std::move(module_), tsctx_)));
   }
+
+  define_runtime(*jit);
+  jit_ = std::move(jit);
 }
 
-Value* JITCompiler::compile_switch_value(const std::shared_ptr<AstPL0> ast) {
-  switch (ast->tag) {
-    case "odd"_:
-      return compile_odd(ast);
-    case "compare"_:
-      return compile_compare(ast);
-    case "expression"_:
-      return compile_expression(ast);
-    case "ident"_:
-      return compile_ident(ast);
-    case "number"_:
-      return compile_number(ast);
-    default:
-      return compile_switch_value(ast->nodes[0]);
+std::vector<std::unique_ptr<MemoryBuffer>> JITCompiler::compile_parallel() {
+  // Split the module into a few partitions per thread (procedures are
+  // spread by name hash) and pass them through bitcode, so that each one
+  // gets its own context and can be compiled independently
+  std::vector<SmallVector<char, 0>> partitions;
+  {
+    Stats::Phase phase("split");
+    SplitModule(*module_, options_.jobs * 4,
+                [&](std::unique_ptr<Module> part) {
+                  partitions.emplace_back();
+                  raw_svector_ostream os(partitions.back());
+                  WriteBitcodeToFile(*part, os);
+                });
+    module_.reset();
+  }
+
+  Stats::Phase phase("compile");
+  std::vector<std::unique_ptr<MemoryBuffer>> objects(partitions.size());
+  std::vector<std::exception_ptr> errors(options_.jobs);
+  std::atomic<size_t> next{0};
+
+  // Each thread takes the next partition, optimizes it and generates an
+  // object with its own target machine
+  auto work = [&](unsigned job) {
+    try {
+      auto tm = check(target_machine_builder(options_).createTargetMachine());
+      for (size_t i; (i = next++) < partitions.size();) {
+        LLVMContext context;
+        const auto& bitcode = partitions[i];
+        auto module = check(parseBitcodeFile(
+            MemoryBufferRef(StringRef(bitcode.data(), bitcode.size()),
+                            "partition"),
+            context));
+        optimize(*module, *tm);
+
+        Stats::Phase codegen("codegen");
+        objects[i] = check(orc::SimpleCompiler(*tm)(*module));
+        Stats::count("machine code bytes", text_size(*objects[i]));
+      }
+    } catch (...) {
+      errors[job] = std::current_exception();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (auto job = 0u; job < options_.jobs; job++) {
+    threads.emplace_back(work, job);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  for (const auto& error : errors) {
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+  return objects;
+}
+
+void JITCompiler::define_runtime(orc::LLJIT& jit) {
+  // Native runtime linked into this process
+  orc::SymbolMap runtime;
+  auto define = [&](const char* name, auto* fn) {
+    runtime[jit.mangleAndIntern(name)] = orc::ExecutorSymbolDef(
+        orc::ExecutorAddr::fromPtr(fn), JITSymbolFlags::Exported);
+  };
+  define("__pl0_out", &__pl0_out);
+  define("__pl0_flush", &__pl0_flush);
+  define("__pl0_in", &__pl0_in);
+  define("__pl0_memo_table", &__pl0_memo_table);
+  define("__pl0_memo_lookup", &__pl0_memo_lookup);
+  define("__pl0_memo_store", &__pl0_memo_store);
+  define("__pl0_profile_proc", &__pl0_profile_proc);
+  define("__pl0_profile_loop", &__pl0_profile_loop);
+  define("__pl0_profile_branch", &__pl0_profile_branch);
+  define("__pl0_print_error", &__pl0_print_error);
+  define("__pl0_fast_fail", &__pl0_fast_fail);
+  define("__pl0_error", &__pl0_error);
+  check(jit.getMainJITDylib().define(orc::absoluteSymbols(std::move(runtime))));
+
+  // The C++ EH runtime comes from the host process
+  jit.getMainJITDylib().addGenerator(
+      check(orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+          jit.getDataLayout().getGlobalPrefix())));
+}
+
+void JITCompiler::run_main(orc::LLJIT& jit) {
+  // Includes the materialization of `main` and of lazily compiled procedures
+  Stats::Phase phase("execute");
+  auto mainFn = check(jit.lookup("main")).toPtr<int (*)()>();
+  mainFn();
+  // The profile is reported after the JIT is gone
+  __pl0_profile_save();
+}
+
+void JITCompiler::dump(const std::string& path) {
+  std::error_code ec;
+  raw_fd_ostream os(path, ec, sys::fs::OF_Text);
+  if (ec) {
+    throw std::runtime_error("can't open '" + path + "': " + ec.message());
+  }
+  module_->print(os, nullptr);
+}
+
+void JITCompiler::emit_file(const std::string& path, CodeGenFileType type) {
+  std::error_code ec;
+  raw_fd_ostream os(path, ec, sys::fs::OF_None);
+  if (ec) {
+    throw std::runtime_error("can't open '" + path + "': " + ec.message());
+  }
+
+  Stats::Phase phase("codegen");
+
+  // Code generation passes modify the IR, so each output gets its own copy
+  auto module = CloneModule(*module_);
+
+  SmallVector<char, 0> buffer;
+  raw_svector_ostream bos(buffer);
+  legacy::PassManager pm;
+  if (tm_->addPassesToEmitFile(pm, bos, nullptr, type)) {
+    throw std::runtime_error("the target can't emit this file type...");
+  }
+  pm.run(*module);
+
+  if (type == CodeGenFileType::ObjectFile) {
+    Stats::count("machine code bytes",
+                 text_size(MemoryBufferRef(
+                     StringRef(buffer.data(), buffer.size()), path)));
+  }
+  os.write(buffer.data(), buffer.size());
+}
+
+void JITCompiler::link(const std::string& obj, const std::string& exe) {
+  Stats::Phase phase("link");
+
+  // The C++ driver brings in libc and the C++ EH runtime used by `main`
+  auto cxx = sys::findProgramByName("c++");
+  if (!cxx) {
+    throw std::runtime_error("can't find a linker (c++)...");
+  }
+
+  // libpl0rt.a is installed next to `pl0` unless $PL0_RUNTIME says otherwise
+  std::string runtime;
+  if (auto env = std::getenv("PL0_RUNTIME")) {
+    runtime = env;
+  } else {
+    SmallString<128> path(sys::fs::getMainExecutable(
+        nullptr, reinterpret_cast<void*>(&__pl0_out)));
+    sys::path::remove_filename(path);
+    sys::path::append(path, "libpl0rt.a");
+    runtime = std::string(path);
+  }
+  if (!sys::fs::exists(runtime)) {
+    throw std::runtime_error("can't find the runtime library '" + runtime +
+                             "'...");
+  }
+
+  std::vector<StringRef> args = {*cxx, obj, runtime, "-o", exe};
+  std::string err;
+  if (sys::ExecuteAndWait(*cxx, args, std::nullopt, {}, 0, 0, &err) != 0) {
+    throw std::runtime_error("link failed: " + (err.empty() ? exe : err));
   }
 }
 
 void JITCompiler::compile_libs() {
-  // `out` function
-  auto outFn =
-      cast<Function>(module_
-                         ->getOrInsertFunction("out", builder_.getVoidTy(),
-                                               builder_.getInt32Ty())
-                         .getCallee());
+  // Native runtime functions (runtime.cc)
+  auto outFn = cast<Function>(
+      module_
+          ->getOrInsertFunction("__pl0_out", builder_.getVoidTy(),
+                                builder_.getInt32Ty())
+          .getCallee());
+  outFn->setDoesNotThrow();
 
-  {
-    auto BB = BasicBlock::Create(context_, "entry", outFn);
-    builder_.SetInsertPoint(BB);
+  auto flushFn = cast<Function>(
+      module_->getOrInsertFunction("__pl0_flush", builder_.getVoidTy())
+          .getCallee());
+  flushFn->setDoesNotThrow();
 
-    auto printFn = module_->getOrInsertFunction(
-        "printf",
-        FunctionType::get(builder_.getInt32Ty(),
-                          PointerType::get(builder_.getInt8Ty(), 0), true));
+  // Throws at the end of input, unless errors fail fast
+  auto inFn = cast<Function>(
+      module_->getOrInsertFunction("__pl0_in", builder_.getInt32Ty())
+          .getCallee());
 
-    auto val = &*outFn->arg_begin();
-    auto fmt = builder_.CreateGlobalStringPtr("%d\n", ".printf.fmt");
-    builder_.CreateCall(printFn, {fmt, val});
+  // Memo tables (--memo)
+  if (options_.memo) {
+    auto ptrTy = builder_.getPtrTy();
+    auto i32Ty = builder_.getInt32Ty();
+    Function* fns[] = {
+        cast<Function>(module_
+                           ->getOrInsertFunction("__pl0_memo_table", ptrTy,
+                                                 ptrTy, i32Ty, i32Ty, i32Ty)
+                           .getCallee()),
+        cast<Function>(module_
+                           ->getOrInsertFunction("__pl0_memo_lookup", i32Ty,
+                                                 ptrTy, ptrTy, ptrTy)
+                           .getCallee()),
+        cast<Function>(module_
+                           ->getOrInsertFunction("__pl0_memo_store",
+                                                 builder_.getVoidTy(), ptrTy,
+                                                 ptrTy, ptrTy)
+                           .getCallee()),
+    };
+    for (auto fn : fns) {
+      fn->setDoesNotThrow();
+    }
+  }
 
-    builder_.CreateRetVoid();
-    verifyFunction(*outFn);
+  // Profile counters (--profile, --profile-out)
+  if (options_.counting()) {
+    for (auto name : {"__pl0_profile_proc", "__pl0_profile_loop",
+                      "__pl0_profile_branch"}) {
+      auto fn = cast<Function>(
+          module_
+              ->getOrInsertFunction(name, builder_.getVoidTy(),
+                                    builder_.getPtrTy(), builder_.getInt32Ty(),
+                                    builder_.getInt32Ty(), builder_.getPtrTy())
+              .getCallee());
+      fn->setDoesNotThrow();
+    }
+  }
+
+  if (options_.fast_fail) {
+    inFn->setDoesNotThrow();
+
+    auto fastFailFn = cast<Function>(
+        module_->getOrInsertFunction("__pl0_fast_fail", builder_.getVoidTy())
+            .getCallee());
+    fastFailFn->setDoesNotThrow();
+
+    auto errorFn = cast<Function>(
+        module_
+            ->getOrInsertFunction("__pl0_error", builder_.getVoidTy(),
+                                  builder_.getPtrTy())
+            .getCallee());
+    errorFn->setDoesNotThrow();
+    errorFn->setDoesNotReturn();
+    errorFn->addFnAttr(Attribute::Cold);
   }
 }
 
-void JITCompiler::compile_program(const std::shared_ptr<AstPL0> ast) {
+void JITCompiler::compile_program() {
+  if (options_.fuel) {
+    fuel_ = new GlobalVariable(*module_, builder_.getInt64Ty(), false,
+                               GlobalValue::InternalLinkage,
+                               builder_.getInt64(options_.fuel), "fuel");
+  }
+
   // `start` function
   auto startFn = cast<Function>(
       module_->getOrInsertFunction("__pl0_start", builder_.getVoidTy())
           .getCallee());
 
+  // `main` function, declared before a procedure can take its name
+  auto mainFn = cast<Function>(
+      module_->getOrInsertFunction("main", builder_.getInt32Ty()).getCallee());
+
   {
     auto BB = BasicBlock::Create(context_, "entry", startFn);
     builder_.SetInsertPoint(BB);
 
-    compile_block(ast->nodes[0]);
+    // Memo tables of the procedures that are memoized
+    memo_tables_.assign(program_->blocks.size(), nullptr);
+    for (auto i = 1u; i < program_->blocks.size(); i++) {
+      const auto& block = program_->blocks[i];
+      if (!options_.memo || !block.memo) {
+        continue;
+      }
+      auto name = std::string(program_->name(block.name));
+      auto table = new GlobalVariable(
+          *module_, builder_.getPtrTy(), false, GlobalValue::InternalLinkage,
+          ConstantPointerNull::get(builder_.getPtrTy()), name + ".memo");
+      auto handle = builder_.CreateCall(
+          module_->getFunction("__pl0_memo_table"),
+          {builder_.CreateGlobalStringPtr(name, ".str." + name),
+           builder_.getInt32(block.inputs.count),
+           builder_.getInt32(block.outputs.count),
+           builder_.getInt32(options_.memo_size)});
+      builder_.CreateStore(handle, table);
+      memo_tables_[i] = table;
+    }
+
+    ProfileEntry profile;
+    if (options_.counting()) {
+      compile_profile_counters();
+      profile = compile_profile_enter(0);
+    }
+
+    compile_block(0);
+
+    if (options_.profile) {
+      compile_profile_exit(0, profile);
+    }
+    if (options_.counting()) {
+      IRBuilder<>(profile_init_).CreateRetVoid();
+      verifyFunction(*profile_init_->getParent());
+    }
 
     builder_.CreateRetVoid();
     verifyFunction(*startFn);
   }
 
-  // `main` function
-  auto mainFn = cast<Function>(
-      module_->getOrInsertFunction("main", builder_.getVoidTy()).getCallee());
+  if (profile_data_) {
+    startFn->setEntryCount(Function::ProfileCount(1, Function::PCT_Real));
+    mainFn->setEntryCount(Function::ProfileCount(1, Function::PCT_Real));
+  }
 
-  {
+  if (options_.fast_fail) {
+    // Errors end the process in the runtime, so nothing unwinds
+    startFn->setDoesNotThrow();
+    mainFn->setDoesNotThrow();
+
+    auto BB = BasicBlock::Create(context_, "entry", mainFn);
+    builder_.SetInsertPoint(BB);
+    builder_.CreateCall(module_->getFunction("__pl0_fast_fail"));
+    builder_.CreateCall(startFn);
+    builder_.CreateCall(module_->getFunction("__pl0_flush"));
+    builder_.CreateRet(builder_.getInt32(0));
+    verifyFunction(*mainFn);
+  } else {
     auto personalityFn = Function::Create(
         FunctionType::get(builder_.getInt32Ty(), {}, true),
         GlobalValue::ExternalLinkage, "__gxx_personality_v0", module_.get());
@@ -150,6 +837,9 @@ void JITCompiler::compile_program(const std::shared_ptr<AstPL0> ast) {
     auto exc = builder_.CreateLandingPad(
         StructType::get(builder_.getPtrTy(), builder_.getInt32Ty()), 1, "exc");
 
+    // Buffered output goes before the error message
+    builder_.CreateCall(module_->getFunction("__pl0_flush"));
+
     exc->addClause(ConstantExpr::getBitCast(tyinfo_, builder_.getPtrTy()));
 
     auto ptr = builder_.CreateExtractValue(exc, {0}, "exc.ptr");
@@ -179,14 +869,14 @@ void JITCompiler::compile_program(const std::shared_ptr<AstPL0> ast) {
     auto endCatchFn =
         module_->getOrInsertFunction("__cxa_end_catch", builder_.getVoidTy());
 
-    auto putFn = module_->getOrInsertFunction("puts", builder_.getInt32Ty(),
-                                              builder_.getPtrTy());
+    auto printFn = module_->getOrInsertFunction(
+        "__pl0_print_error", builder_.getVoidTy(), builder_.getPtrTy());
 
     {
       builder_.SetInsertPoint(catch_with_message);
 
       auto str = builder_.CreateCall(beginCatchFn, ptr, "str");
-      builder_.CreateCall(putFn, str);
+      builder_.CreateCall(printFn, str);
       builder_.CreateCall(endCatchFn);
       builder_.CreateBr(endBB);
     }
@@ -197,7 +887,7 @@ void JITCompiler::compile_program(const std::shared_ptr<AstPL0> ast) {
       builder_.CreateCall(beginCatchFn, ptr);
       auto str =
           builder_.CreateGlobalStringPtr("unknown error...", ".str.unknown");
-      builder_.CreateCall(putFn, str);
+      builder_.CreateCall(printFn, str);
       builder_.CreateCall(endCatchFn);
       builder_.CreateBr(endBB);
     }
@@ -206,56 +896,208 @@ void JITCompiler::compile_program(const std::shared_ptr<AstPL0> ast) {
       endBB->insertInto(fn);
       builder_.SetInsertPoint(endBB);
 
-      builder_.CreateRetVoid();
+      builder_.CreateCall(module_->getFunction("__pl0_flush"));
+      builder_.CreateRet(builder_.getInt32(0));
     }
 
     verifyFunction(*mainFn);
   }
 }
 
-void JITCompiler::compile_block(const std::shared_ptr<AstPL0> ast) {
-  compile_const(ast->nodes[0]);
-  compile_var(ast->nodes[1]);
-  compile_procedure(ast->nodes[2]);
-  compile_statement(ast->nodes[3]);
+void JITCompiler::compile_block(ir::Index index) {
+  const auto& block = program_->blocks[index];
+  auto outerBlock = block_;
+  block_ = index;
+  if (options_.frames) {
+    Frame frame;
+    compile_frame(index, frame);
+
+    auto outer = frame_;
+    frame_ = &frame;
+    compile_procedure(block);
+    compile_statement(block.body);
+    frame_ = outer;
+  } else {
+    compile_var(block);
+    compile_procedure(block);
+    compile_statement(block.body);
+  }
+  block_ = outerBlock;
 }
 
-void JITCompiler::compile_const(const std::shared_ptr<AstPL0> ast) {
-  for (auto i = 0u; i < ast->nodes.size(); i += 2) {
-    auto ident = ast->nodes[i]->token;
-    auto number = ast->nodes[i + 1]->token_to_number<int>();
+void JITCompiler::compile_var(const ir::Block& block) {
+  // Arrays of the main block are globals rather than taking up the stack
+  auto main = block.outer == ir::kNone;
+  for (auto i = 0u; i < block.vars.count; i++) {
+    auto decl = block.vars.first + i;
+    values_[decl] = compile_storage(decl, main && program_->decls[decl].size);
+  }
+}
 
-    auto alloca = builder_.CreateAlloca(builder_.getInt32Ty(), nullptr, ident);
-    builder_.CreateStore(builder_.getInt32(number), alloca);
+Value* JITCompiler::compile_storage(ir::Index decl, bool global) {
+  const auto& var = program_->decls[decl];
+  auto name = program_->name(var.name);
+  if (!var.size) {
+    if (global) {
+      return new GlobalVariable(*module_, builder_.getInt32Ty(), false,
+                                GlobalValue::InternalLinkage,
+                                builder_.getInt32(0), name);
+    }
+    return builder_.CreateAlloca(builder_.getInt32Ty(), nullptr, name);
   }
+
+  // Arrays are contiguous and start on a cache line, so that vectorized
+  // loops over them load and store whole lines
+  auto type = ArrayType::get(builder_.getInt32Ty(), var.size);
+  if (global) {
+    auto array =
+        new GlobalVariable(*module_, type, false, GlobalValue::InternalLinkage,
+                           ConstantAggregateZero::get(type), name);
+    array->setAlignment(Align(kArrayAlign));
+    return array;
+  }
+  auto array = builder_.CreateAlloca(type, nullptr, name);
+  array->setAlignment(Align(kArrayAlign));
+  builder_.CreateMemSet(array, builder_.getInt8(0),
+                        static_cast<uint64_t>(var.size) * 4,
+                        Align(kArrayAlign));
+  return array;
 }
 
-void JITCompiler::compile_var(const std::shared_ptr<AstPL0> ast) {
-  for (const auto node : ast->nodes) {
-    auto ident = node->token;
-    builder_.CreateAlloca(builder_.getInt32Ty(), nullptr, ident);
+// Mark the variables of block `index` (by slot) that procedures nested in
+// `block` use
+static void find_captured(const Program& program, ir::Index index,
+                          const ir::Block& block,
+                          std::vector<bool>& captured) {
+  for (auto i = 0u; i < block.procs.count; i++) {
+    const auto& inner = program.blocks[program.list_of(block.procs)[i]];
+    for (auto j = 0u; j < inner.free.count; j++) {
+      auto decl = program.list_of(inner.free)[j];
+      if (program.decls[decl].block == index) {
+        captured[program.slot(decl)] = true;
+      }
+    }
+    find_captured(program, index, inner, captured);
   }
 }
 
-void JITCompiler::compile_procedure(const std::shared_ptr<AstPL0> ast) {
-  for (auto i = 0u; i < ast->nodes.size(); i += 2) {
-    auto ident = ast->nodes[i]->token;
-    auto block = ast->nodes[i + 1];
+void JITCompiler::compile_frame(ir::Index index, Frame& frame) {
+  const auto& block = program_->blocks[index];
+  auto fn = builder_.GetInsertBlock()->getParent();
+  frame.outer = frame_;
+  frame.block = index;
+  if (frame_ && fn->arg_size()) {
+    frame.link = fn->getArg(0);
+  }
 
-    std::vector<Type*> pt(block->scope->free_variables.size(),
-                          PointerType::get(builder_.getInt32Ty(), 0));
-    auto fn = cast<Function>(
-        module_
-            ->getOrInsertFunction(
-                ident, FunctionType::get(builder_.getVoidTy(), pt, false))
-            .getCallee());
+  std::vector<bool> captured(block.vars.count);
+  find_captured(*program_, index, block, captured);
 
-    {
-      auto it = block->scope->free_variables.begin();
+  auto vars = program_->decls_of(block.vars);
+  frame.variables.resize(block.vars.count);
+  frame.fields.resize(block.vars.count);
+
+  if (!frame_) {
+    // The main block runs once, so its captured variables become globals
+    // that procedures use directly
+    for (auto i = 0u; i < block.vars.count; i++) {
+      frame.variables[i] = compile_storage(block.vars.first + i,
+                                           captured[i] || vars[i].size);
+    }
+  } else {
+    // Nested procedures get one pointer to this record, the rest stays in
+    // registers
+    std::vector<Type*> types;
+    auto linked = frame.link && block.procs.count;
+    if (linked) {
+      types.push_back(frame.link->getType());
+    }
+    for (auto i = 0u; i < block.vars.count; i++) {
+      if (captured[i]) {
+        frame.fields[i] = types.size();
+        types.push_back(
+            vars[i].size
+                ? ArrayType::get(builder_.getInt32Ty(), vars[i].size)
+                : static_cast<Type*>(builder_.getInt32Ty()));
+      }
+    }
+
+    if (!types.empty()) {
+      frame.type =
+          StructType::create(context_, types, (fn->getName() + ".frame").str());
+      frame.record = builder_.CreateAlloca(frame.type, nullptr, "frame");
+      if (linked) {
+        auto slot = builder_.CreateStructGEP(frame.type, frame.record, 0);
+        builder_.CreateStore(frame.link, slot);
+      }
+    }
+
+    for (auto i = 0u; i < block.vars.count; i++) {
+      auto name = program_->name(vars[i].name);
+      if (!captured[i]) {
+        frame.variables[i] = compile_storage(block.vars.first + i, false);
+        continue;
+      }
+      frame.variables[i] = builder_.CreateStructGEP(frame.type, frame.record,
+                                                    frame.fields[i], name);
+      if (vars[i].size) {
+        builder_.CreateMemSet(frame.variables[i], builder_.getInt8(0),
+                              static_cast<uint64_t>(vars[i].size) * 4,
+                              MaybeAlign(4));
+      }
+    }
+  }
+}
+
+void JITCompiler::compile_procedure(const ir::Block& outer) {
+  for (auto i = 0u; i < outer.procs.count; i++) {
+    auto index = program_->list_of(outer.procs)[i];
+    const auto& block = program_->blocks[index];
+    auto free = program_->list_of(block.free);
+
+    std::vector<Type*> pt;
+    if (!options_.frames) {
+      pt.assign(block.free.count, PointerType::get(builder_.getInt32Ty(), 0));
+    } else if (frame_->record) {
+      // Static link
+      pt.push_back(PointerType::get(frame_->type, 0));
+    }
+    auto fn = Function::Create(
+        FunctionType::get(builder_.getVoidTy(), pt, false),
+        GlobalValue::ExternalLinkage, profile_name(index), module_.get());
+    functions_[index] = fn;
+
+    if (options_.fast_fail) {
+      fn->setDoesNotThrow();
+    }
+
+    if (profile_data_) {
+      if (auto calls = profile_data_->find("proc " + profile_name(index))) {
+        fn->setEntryCount(
+            Function::ProfileCount((*calls)[0], Function::PCT_Real));
+      }
+    }
+
+    if (options_.frames) {
       for (auto& arg : fn->args()) {
-        auto& sv = *it;
-        arg.setName(sv);
-        ++it;
+        arg.setName("link");
+      }
+    }
+
+    // Free variables are the arguments inside the procedure. Each one is a
+    // different variable, so they never alias, and an array argument points
+    // to all of its elements.
+    std::vector<Value*> saved;
+    if (!options_.frames) {
+      for (auto j = 0u; j < block.free.count; j++) {
+        const auto& var = program_->decls[free[j]];
+        auto arg = fn->getArg(j);
+        arg->setName(program_->name(var.name));
+        arg->addAttr(Attribute::NoAlias);
+        arg->addAttr(Attribute::getWithDereferenceableBytes(
+            context_, static_cast<uint64_t>(std::max(var.size, 1u)) * 4));
+        saved.push_back(values_[free[j]]);
+        values_[free[j]] = arg;
       }
     }
 
@@ -263,80 +1105,463 @@ void JITCompiler::compile_procedure(const std::shared_ptr<AstPL0> ast) {
       auto prevBB = builder_.GetInsertBlock();
       auto BB = BasicBlock::Create(context_, "entry", fn);
       builder_.SetInsertPoint(BB);
-      compile_block(block);
+      ProfileEntry profile;
+      if (options_.counting()) {
+        profile = compile_profile_enter(index);
+      }
+      if (fuel_) {
+        compile_fuel(block.loc);
+      }
+      compile_block(index);
+      if (options_.profile) {
+        compile_profile_exit(index, profile);
+      }
       builder_.CreateRetVoid();
       verifyFunction(*fn);
       builder_.SetInsertPoint(prevBB);
     }
+
+    for (auto j = 0u; j < saved.size(); j++) {
+      values_[free[j]] = saved[j];
+    }
+
+    if (entries_) {
+      // Adapter for the interpreter, which passes the free variable
+      // pointers as an array
+      auto ptrTy = PointerType::get(builder_.getInt32Ty(), 0);
+      auto entryFn = Function::Create(
+          FunctionType::get(builder_.getVoidTy(), {PointerType::get(ptrTy, 0)},
+                            false),
+          GlobalValue::ExternalLinkage, fn->getName() + ".entry",
+          module_.get());
+      entry_symbols_[index] = entryFn->getName().str();
+
+      auto prevBB = builder_.GetInsertBlock();
+      auto BB = BasicBlock::Create(context_, "entry", entryFn);
+      builder_.SetInsertPoint(BB);
+
+      std::vector<Value*> args;
+      auto array = &*entryFn->arg_begin();
+      for (auto j = 0u; j < pt.size(); j++) {
+        auto slot = builder_.CreateConstGEP1_32(ptrTy, array, j);
+        args.push_back(builder_.CreateLoad(ptrTy, slot));
+      }
+      builder_.CreateCall(fn, args);
+      builder_.CreateRetVoid();
+      verifyFunction(*entryFn);
+      builder_.SetInsertPoint(prevBB);
+    }
   }
 }
 
-void JITCompiler::compile_statement(const std::shared_ptr<AstPL0> ast) {
-  if (!ast->nodes.empty()) {
-    compile_switch(ast->nodes[0]);
+void JITCompiler::compile_statement(ir::Index index) {
+  const auto& stmt = program_->stmts[index];
+  switch (stmt.kind) {
+    case ir::StmtKind::empty:
+      break;
+    case ir::StmtKind::assignment:
+      compile_assignment(stmt);
+      break;
+    case ir::StmtKind::call:
+      compile_call(stmt);
+      break;
+    case ir::StmtKind::statements:
+      compile_statements(stmt);
+      break;
+    case ir::StmtKind::if_:
+      compile_if(stmt);
+      break;
+    case ir::StmtKind::while_:
+      compile_while(stmt);
+      break;
+    case ir::StmtKind::out:
+      compile_out(stmt);
+      break;
+    case ir::StmtKind::in:
+      compile_in(stmt);
+      break;
   }
 }
 
-void JITCompiler::compile_assignment(const std::shared_ptr<AstPL0> ast) {
-  auto ident = ast->nodes[0]->token;
-
-  auto fn = builder_.GetInsertBlock()->getParent();
-  auto tbl = fn->getValueSymbolTable();
-  auto var = tbl->lookup(ident);
-  if (!var) {
-    throw_runtime_error(ast,
-                        "'" + std::string(ident) + "' is not defined...");
+void JITCompiler::compile_assignment(const ir::Stmt& stmt) {
+  if (stmt.index != ir::kNone) {
+    auto index = compile_expression(stmt.index);
+    auto val = compile_expression(stmt.expr);
+    builder_.CreateStore(val, compile_element(stmt.target, index));
+    return;
   }
-
-  auto val = compile_expression(ast->nodes[1]);
+  auto var = compile_variable(stmt.target);
+  auto val = compile_expression(stmt.expr);
   builder_.CreateStore(val, var);
 }
 
-void JITCompiler::compile_call(const std::shared_ptr<AstPL0> ast) {
-  auto ident = ast->nodes[0]->token;
-
-  auto scope = get_closest_scope(ast);
-  auto block = scope->get_procedure(ident);
+void JITCompiler::compile_call(const ir::Stmt& stmt) {
+  const auto& block = program_->blocks[stmt.target];
 
   std::vector<Value*> args;
-  for (auto& free : block->scope->free_variables) {
-    auto fn = builder_.GetInsertBlock()->getParent();
-    auto tbl = fn->getValueSymbolTable();
-    auto var = tbl->lookup(free);
-    if (!var) {
-      throw_runtime_error(ast, "'" + std::string(free) + "' is not defined...");
+  if (options_.frames) {
+    // Static link to the record of the declaring block
+    auto frame = frame_;
+    while (frame->block != block.outer) {
+      frame = frame->outer;
+    }
+    if (frame->record) {
+      args.push_back(compile_record(frame));
+    }
+  } else {
+    for (auto i = 0u; i < block.free.count; i++) {
+      args.push_back(compile_variable(program_->list_of(block.free)[i]));
     }
-    args.push_back(var);
   }
 
-  auto fn = module_->getFunction(ident);
+  auto fn = functions_[stmt.target];
+  if (memo_tables_[stmt.target]) {
+    compile_memo_call(stmt.target, fn, args);
+    return;
+  }
   builder_.CreateCall(fn, args);
 }
 
-void JITCompiler::compile_statements(const std::shared_ptr<AstPL0> ast) {
-  for (auto node : ast->nodes) {
-    compile_statement(node);
+void JITCompiler::compile_memo_call(ir::Index index, Function* fn,
+                                    const std::vector<Value*>& args) {
+  const auto& block = program_->blocks[index];
+  auto inputs = program_->list_of(block.inputs);
+  auto outputs = program_->list_of(block.outputs);
+
+  // Key and value arrays in the entry block
+  auto caller = builder_.GetInsertBlock()->getParent();
+  IRBuilder<> entry(&caller->getEntryBlock(),
+                    caller->getEntryBlock().begin());
+  auto keyTy = ArrayType::get(builder_.getInt32Ty(),
+                              std::max(block.inputs.count, 1u));
+  auto valuesTy = ArrayType::get(builder_.getInt32Ty(), block.outputs.count);
+  auto key = entry.CreateAlloca(keyTy, nullptr, "memo.key");
+  auto values = entry.CreateAlloca(valuesTy, nullptr, "memo.values");
+  auto keyPtr = builder_.CreateBitCast(key, builder_.getPtrTy());
+  auto valuesPtr = builder_.CreateBitCast(values, builder_.getPtrTy());
+
+  for (auto i = 0u; i < block.inputs.count; i++) {
+    auto val = builder_.CreateLoad(builder_.getInt32Ty(),
+                                   compile_variable(inputs[i]));
+    builder_.CreateStore(val,
+                         builder_.CreateConstGEP2_32(keyTy, key, 0, i));
   }
+
+  auto table =
+      builder_.CreateLoad(builder_.getPtrTy(), memo_tables_[index], "table");
+  auto hit = builder_.CreateCall(module_->getFunction("__pl0_memo_lookup"),
+                                 {table, keyPtr, valuesPtr}, "hit");
+
+  auto hitBB = BasicBlock::Create(context_, "memo.hit", caller);
+  auto missBB = BasicBlock::Create(context_, "memo.miss", caller);
+  auto storeBB = BasicBlock::Create(context_, "memo.store", caller);
+  auto endBB = BasicBlock::Create(context_, "memo.end", caller);
+  builder_.CreateCondBr(builder_.CreateICmpNE(hit, builder_.getInt32(0)),
+                        hitBB, missBB);
+
+  // hit: the outputs the call would have written
+  builder_.SetInsertPoint(hitBB);
+  for (auto i = 0u; i < block.outputs.count; i++) {
+    auto val = builder_.CreateLoad(
+        builder_.getInt32Ty(),
+        builder_.CreateConstGEP2_32(valuesTy, values, 0, i));
+    builder_.CreateStore(val, compile_variable(outputs[i]));
+  }
+  builder_.CreateBr(endBB);
+
+  // miss: call the procedure. An output that isn't part of the key and
+  // still has its old value may not have been written at all, in which
+  // case the value depends on the caller and the result can't be cached.
+  builder_.SetInsertPoint(missBB);
+  auto isInput = [&](ir::Index decl) {
+    return std::binary_search(inputs, inputs + block.inputs.count, decl);
+  };
+  std::vector<Value*> before(block.outputs.count, nullptr);
+  for (auto i = 0u; i < block.outputs.count; i++) {
+    if (!isInput(outputs[i])) {
+      before[i] = builder_.CreateLoad(builder_.getInt32Ty(),
+                                      compile_variable(outputs[i]));
+    }
+  }
+
+  builder_.CreateCall(fn, args);
+
+  Value* cacheable = builder_.getTrue();
+  for (auto i = 0u; i < block.outputs.count; i++) {
+    auto val = builder_.CreateLoad(builder_.getInt32Ty(),
+                                   compile_variable(outputs[i]));
+    builder_.CreateStore(val,
+                         builder_.CreateConstGEP2_32(valuesTy, values, 0, i));
+    if (before[i]) {
+      cacheable =
+          builder_.CreateAnd(cacheable, builder_.CreateICmpNE(val, before[i]));
+    }
+  }
+  builder_.CreateCondBr(cacheable, storeBB, endBB);
+
+  builder_.SetInsertPoint(storeBB);
+  builder_.CreateCall(module_->getFunction("__pl0_memo_store"),
+                      {table, keyPtr, valuesPtr});
+  builder_.CreateBr(endBB);
+
+  builder_.SetInsertPoint(endBB);
 }
 
-void JITCompiler::compile_if(const std::shared_ptr<AstPL0> ast) {
-  auto cond = compile_condition(ast->nodes[0]);
+void JITCompiler::compile_profile_counters() {
+  auto countersTy = ArrayType::get(builder_.getInt64Ty(), 4);
+  profile_callees_ = new GlobalVariable(
+      *module_, builder_.getInt64Ty(), false, GlobalValue::InternalLinkage,
+      builder_.getInt64(0), "profile.callees");
+
+  // The counters are registered before the main block runs
+  auto initFn = Function::Create(
+      FunctionType::get(builder_.getVoidTy(), false),
+      GlobalValue::InternalLinkage, "__pl0_profile_init", module_.get());
+  initFn->setDoesNotThrow();
+  profile_init_ = BasicBlock::Create(context_, "entry", initFn);
+  builder_.CreateCall(initFn);
+
+  IRBuilder<> init(profile_init_);
+  profile_counters_.assign(program_->blocks.size(), nullptr);
+  for (auto i = 0u; i < program_->blocks.size(); i++) {
+    const auto& block = program_->blocks[i];
+    auto name = profile_name(i);
+    auto counters = new GlobalVariable(
+        *module_, countersTy, false, GlobalValue::InternalLinkage,
+        ConstantAggregateZero::get(countersTy), name + ".profile");
+    init.CreateCall(module_->getFunction("__pl0_profile_proc"),
+                    {init.CreateGlobalStringPtr(name, ".str." + name),
+                     init.getInt32(block.loc.line),
+                     init.getInt32(block.loc.column),
+                     init.CreateBitCast(counters, builder_.getPtrTy())});
+    profile_counters_[i] = counters;
+  }
+}
+
+// Counts the call and starts the clock. The callees' cycles are saved and
+// restarted from 0, so that at the exit they can be taken out of the
+// procedure's own cycles.
+JITCompiler::ProfileEntry JITCompiler::compile_profile_enter(
+    ir::Index index) {
+  auto countersTy = ArrayType::get(builder_.getInt64Ty(), 4);
+  auto counters = profile_counters_[index];
+  auto i64Ty = builder_.getInt64Ty();
+
+  auto calls = builder_.CreateConstGEP2_32(countersTy, counters, 0, 0);
+  builder_.CreateStore(
+      builder_.CreateAdd(builder_.CreateLoad(i64Ty, calls),
+                         builder_.getInt64(1)),
+      calls);
+  if (!options_.profile) {
+    return {};
+  }
+
+  auto active = builder_.CreateConstGEP2_32(countersTy, counters, 0, 1);
+  builder_.CreateStore(
+      builder_.CreateAdd(builder_.CreateLoad(i64Ty, active),
+                         builder_.getInt64(1)),
+      active);
+
+  ProfileEntry entry;
+  entry.callees = builder_.CreateLoad(i64Ty, profile_callees_, "callees");
+  builder_.CreateStore(builder_.getInt64(0), profile_callees_);
+  entry.start =
+      builder_.CreateIntrinsic(Intrinsic::readcyclecounter, {}, {}, nullptr,
+                               "start");
+  return entry;
+}
+
+// Adds the cycles since the entry to the procedure's own cycles (without
+// its callees), to its total when this is its outermost active call, and to
+// the callee cycles of the caller
+void JITCompiler::compile_profile_exit(ir::Index index,
+                                       const ProfileEntry& entry) {
+  auto countersTy = ArrayType::get(builder_.getInt64Ty(), 4);
+  auto counters = profile_counters_[index];
+  auto i64Ty = builder_.getInt64Ty();
+
+  auto end = builder_.CreateIntrinsic(Intrinsic::readcyclecounter, {}, {},
+                                      nullptr, "end");
+  auto elapsed = builder_.CreateSub(end, entry.start, "elapsed");
+
+  auto self = builder_.CreateConstGEP2_32(countersTy, counters, 0, 3);
+  auto callees = builder_.CreateLoad(i64Ty, profile_callees_);
+  builder_.CreateStore(
+      builder_.CreateAdd(builder_.CreateLoad(i64Ty, self),
+                         builder_.CreateSub(elapsed, callees)),
+      self);
+
+  auto active = builder_.CreateConstGEP2_32(countersTy, counters, 0, 1);
+  auto depth = builder_.CreateSub(builder_.CreateLoad(i64Ty, active),
+                                  builder_.getInt64(1));
+  builder_.CreateStore(depth, active);
+  auto cycles = builder_.CreateConstGEP2_32(countersTy, counters, 0, 2);
+  builder_.CreateStore(
+      builder_.CreateAdd(
+          builder_.CreateLoad(i64Ty, cycles),
+          builder_.CreateSelect(
+              builder_.CreateICmpEQ(depth, builder_.getInt64(0)), elapsed,
+              builder_.getInt64(0))),
+      cycles);
+
+  builder_.CreateStore(builder_.CreateAdd(entry.callees, elapsed),
+                       profile_callees_);
+}
+
+void JITCompiler::compile_profile_summary() {
+  // Cutoffs (per million of the total count) used by LLVM's own profiles;
+  // the 99% and 99.9999% entries decide what's hot and what's cold
+  static const uint32_t cutoffs[] = {10000,  100000, 200000, 300000, 400000,
+                                     500000, 600000, 700000, 800000, 900000,
+                                     950000, 990000, 999000, 999900, 999990,
+                                     999999};
+
+  auto counts = profile_data_->counts();
+  std::sort(counts.begin(), counts.end(), std::greater<uint64_t>());
+  uint64_t total = 0;
+  for (auto count : counts) {
+    total += count;
+  }
+
+  SummaryEntryVector detailed;
+  uint64_t sum = 0;
+  size_t n = 0;
+  for (auto cutoff : cutoffs) {
+    auto target = static_cast<uint64_t>(
+        static_cast<double>(total) * cutoff / ProfileSummary::Scale);
+    while (n < counts.size() && (sum < target || n == 0)) {
+      sum += counts[n++];
+    }
+    detailed.push_back({cutoff, n ? counts[n - 1] : 0, n});
+  }
+
+  uint64_t max = counts.empty() ? 0 : counts[0];
+  profile_summary_ = std::make_unique<ProfileSummary>(
+      ProfileSummary::PSK_Instr, detailed, total, max, max, max,
+      static_cast<uint32_t>(counts.size()),
+      static_cast<uint32_t>(program_->blocks.size()));
+  module_->setProfileSummary(profile_summary_->getMD(context_),
+                             ProfileSummary::PSK_Instr);
+}
+
+// Procedures are named by their nesting, which stays the same when the
+// source is edited elsewhere
+std::string JITCompiler::profile_name(ir::Index index) const {
+  std::string name;
+  for (; index; index = program_->blocks[index].outer) {
+    auto ident = std::string(program_->name(program_->blocks[index].name));
+    name = name.empty() ? ident : ident + "." + name;
+  }
+  return name.empty() ? "main" : name;
+}
+
+MDNode* JITCompiler::profile_weights(const char* kind, ir::Location loc) {
+  if (!profile_data_) {
+    return nullptr;
+  }
+  const auto& block = program_->blocks[block_];
+  auto key = std::string(kind) + " " + profile_name(block_) + " " +
+             std::to_string(static_cast<int64_t>(loc.line) - block.loc.line) +
+             ":" + std::to_string(loc.column);
+  auto counts = profile_data_->find(key);
+  if (!counts) {
+    return nullptr;
+  }
+
+  // Condition true and false: for an IF the taken count and the rest of
+  // its executions, for a WHILE the iterations and the entries (each entry
+  // leaves the loop once)
+  uint64_t taken, other;
+  if (!std::strcmp(kind, "if")) {
+    taken = (*counts)[1];
+    other = (*counts)[0] - std::min((*counts)[0], taken);
+  } else {
+    taken = (*counts)[1];
+    other = (*counts)[0];
+  }
+
+  // Weights are 32 bits
+  auto scale = std::max(taken, other) / UINT32_MAX + 1;
+  return MDBuilder(context_).createBranchWeights(
+      static_cast<uint32_t>(taken / scale + 1),
+      static_cast<uint32_t>(other / scale + 1));
+}
+
+void JITCompiler::compile_statements(const ir::Stmt& stmt) {
+  for (auto i = 0u; i < stmt.count; i++) {
+    compile_statement(program_->lists[stmt.first + i]);
+  }
+}
+
+void JITCompiler::compile_if(const ir::Stmt& stmt) {
+  auto cond = compile_condition(stmt.expr);
+
+  // Executions and how often the condition held
+  auto countersTy = ArrayType::get(builder_.getInt64Ty(), 2);
+  GlobalVariable* counters = nullptr;
+  if (options_.counting()) {
+    auto proc = profile_name(block_);
+    counters = new GlobalVariable(
+        *module_, countersTy, false, GlobalValue::InternalLinkage,
+        ConstantAggregateZero::get(countersTy), proc + ".if");
+    IRBuilder<> init(profile_init_);
+    init.CreateCall(module_->getFunction("__pl0_profile_branch"),
+                    {init.CreateGlobalStringPtr(proc, ".str." + proc),
+                     init.getInt32(stmt.loc.line),
+                     init.getInt32(stmt.loc.column),
+                     init.CreateBitCast(counters, builder_.getPtrTy())});
+    auto executions = builder_.CreateConstGEP2_32(countersTy, counters, 0, 0);
+    builder_.CreateStore(
+        builder_.CreateAdd(builder_.CreateLoad(builder_.getInt64Ty(),
+                                               executions),
+                           builder_.getInt64(1)),
+        executions);
+  }
 
   auto fn = builder_.GetInsertBlock()->getParent();
   auto ifTenBB = BasicBlock::Create(context_, "if.then", fn);
   auto ifEndBB = BasicBlock::Create(context_, "if.end");
 
-  builder_.CreateCondBr(cond, ifTenBB, ifEndBB);
+  builder_.CreateCondBr(cond, ifTenBB, ifEndBB,
+                        profile_weights("if", stmt.loc));
 
   builder_.SetInsertPoint(ifTenBB);
-  compile_statement(ast->nodes[1]);
+  if (counters) {
+    auto taken = builder_.CreateConstGEP2_32(countersTy, counters, 0, 1);
+    builder_.CreateStore(
+        builder_.CreateAdd(builder_.CreateLoad(builder_.getInt64Ty(), taken),
+                           builder_.getInt64(1)),
+        taken);
+  }
+  compile_statement(stmt.body);
   builder_.CreateBr(ifEndBB);
 
   ifEndBB->insertInto(fn);
   builder_.SetInsertPoint(ifEndBB);
 }
 
-void JITCompiler::compile_while(const std::shared_ptr<AstPL0> ast) {
+void JITCompiler::compile_while(const ir::Stmt& stmt) {
+  // Iterations (back edges) and entries
+  auto countersTy = ArrayType::get(builder_.getInt64Ty(), 2);
+  GlobalVariable* counters = nullptr;
+  if (options_.counting()) {
+    auto proc = profile_name(block_);
+    counters = new GlobalVariable(
+        *module_, countersTy, false, GlobalValue::InternalLinkage,
+        ConstantAggregateZero::get(countersTy), proc + ".loop");
+    IRBuilder<> init(profile_init_);
+    init.CreateCall(module_->getFunction("__pl0_profile_loop"),
+                    {init.CreateGlobalStringPtr(proc, ".str." + proc),
+                     init.getInt32(stmt.loc.line),
+                     init.getInt32(stmt.loc.column),
+                     init.CreateBitCast(counters, builder_.getPtrTy())});
+    auto entries = builder_.CreateConstGEP2_32(countersTy, counters, 0, 1);
+    builder_.CreateStore(
+        builder_.CreateAdd(builder_.CreateLoad(builder_.getInt64Ty(), entries),
+                           builder_.getInt64(1)),
+        entries);
+  }
+
   auto whileCondBB = BasicBlock::Create(context_, "while.cond");
   builder_.CreateBr(whileCondBB);
 
@@ -344,14 +1569,28 @@ void JITCompiler::compile_while(const std::shared_ptr<AstPL0> ast) {
   whileCondBB->insertInto(fn);
   builder_.SetInsertPoint(whileCondBB);
 
-  auto cond = compile_condition(ast->nodes[0]);
+  auto cond = compile_condition(stmt.expr);
 
   auto whileBodyBB = BasicBlock::Create(context_, "while.body", fn);
   auto whileEndBB = BasicBlock::Create(context_, "while.end");
-  builder_.CreateCondBr(cond, whileBodyBB, whileEndBB);
+  builder_.CreateCondBr(cond, whileBodyBB, whileEndBB,
+                        profile_weights("loop", stmt.loc));
 
   builder_.SetInsertPoint(whileBodyBB);
-  compile_statement(ast->nodes[1]);
+  compile_statement(stmt.body);
+
+  if (counters) {
+    auto iterations = builder_.CreateConstGEP2_32(countersTy, counters, 0, 0);
+    builder_.CreateStore(
+        builder_.CreateAdd(builder_.CreateLoad(builder_.getInt64Ty(),
+                                               iterations),
+                           builder_.getInt64(1)),
+        iterations);
+  }
+
+  if (fuel_) {
+    compile_fuel(stmt.loc);
+  }
 
   builder_.CreateBr(whileCondBB);
 
@@ -359,167 +1598,229 @@ void JITCompiler::compile_while(const std::shared_ptr<AstPL0> ast) {
   builder_.SetInsertPoint(whileEndBB);
 }
 
-Value* JITCompiler::compile_condition(const std::shared_ptr<AstPL0> ast) {
-  return compile_switch_value(ast->nodes[0]);
+void JITCompiler::compile_out(const ir::Stmt& stmt) {
+  auto val = compile_expression(stmt.expr);
+  auto fn = module_->getFunction("__pl0_out");
+  builder_.CreateCall(fn, val);
 }
 
-Value* JITCompiler::compile_odd(const std::shared_ptr<AstPL0> ast) {
-  auto val = compile_expression(ast->nodes[0]);
-  return builder_.CreateICmpNE(val, builder_.getInt32(0), "icmpne");
+void JITCompiler::compile_in(const ir::Stmt& stmt) {
+  if (stmt.index != ir::kNone) {
+    auto index = compile_expression(stmt.index);
+    auto val = builder_.CreateCall(module_->getFunction("__pl0_in"));
+    builder_.CreateStore(val, compile_element(stmt.target, index));
+    return;
+  }
+  auto var = compile_variable(stmt.target);
+  auto val = builder_.CreateCall(module_->getFunction("__pl0_in"));
+  builder_.CreateStore(val, var);
 }
 
-Value* JITCompiler::compile_compare(const std::shared_ptr<AstPL0> ast) {
-  auto lhs = compile_expression(ast->nodes[0]);
-  auto rhs = compile_expression(ast->nodes[2]);
+Value* JITCompiler::compile_condition(ir::Index index) {
+  const auto& expr = program_->exprs[index];
+  if (expr.kind == ir::ExprKind::odd) {
+    auto val = compile_expression(expr.lhs);
+    return builder_.CreateICmpNE(val, builder_.getInt32(0), "icmpne");
+  }
 
-  auto ope = ast->nodes[1]->token;
-  switch (ope[0]) {
-    case '=':
+  auto lhs = compile_expression(expr.lhs);
+  auto rhs = compile_expression(expr.rhs);
+  switch (expr.kind) {
+    case ir::ExprKind::eq:
       return builder_.CreateICmpEQ(lhs, rhs, "icmpeq");
-    case '#':
+    case ir::ExprKind::ne:
       return builder_.CreateICmpNE(lhs, rhs, "icmpne");
-    case '<':
-      if (ope.size() == 1) {
-        return builder_.CreateICmpSLT(lhs, rhs, "icmpslt");
-      }
-      // '<='
+    case ir::ExprKind::lt:
+      return builder_.CreateICmpSLT(lhs, rhs, "icmpslt");
+    case ir::ExprKind::le:
       return builder_.CreateICmpSLE(lhs, rhs, "icmpsle");
-    case '>':
-      if (ope.size() == 1) {
-        return builder_.CreateICmpSGT(lhs, rhs, "icmpsgt");
-      }
-      // '>='
+    case ir::ExprKind::gt:
+      return builder_.CreateICmpSGT(lhs, rhs, "icmpsgt");
+    case ir::ExprKind::ge:
       return builder_.CreateICmpSGE(lhs, rhs, "icmpsge");
+    default:
+      return nullptr;
   }
-  return nullptr;
 }
 
-void JITCompiler::compile_out(const std::shared_ptr<AstPL0> ast) {
-  auto val = compile_expression(ast->nodes[0]);
-  auto fn = module_->getFunction("out");
-  builder_.CreateCall(fn, val);
-}
-
-Value* JITCompiler::compile_expression(const std::shared_ptr<AstPL0> ast) {
-  const auto& nodes = ast->nodes;
-
-  auto sign = nodes[0]->token;
-  auto negative = !(sign.empty() || sign == "+");
-
-  auto val = compile_term(nodes[1]);
-  if (negative) {
-    val = builder_.CreateNeg(val, "negative");
-  }
-
-  for (auto i = 2u; i < nodes.size(); i += 2) {
-    auto ope = nodes[i + 0]->token[0];
-    auto rval = compile_term(nodes[i + 1]);
-    switch (ope) {
-      case '+':
-        val = builder_.CreateAdd(val, rval, "add");
-        break;
-      case '-':
-        val = builder_.CreateSub(val, rval, "sub");
-        break;
-    }
-  }
-  return val;
-}
-
-Value* JITCompiler::compile_term(const std::shared_ptr<AstPL0> ast) {
-  const auto& nodes = ast->nodes;
-  auto val = compile_factor(nodes[0]);
-  for (auto i = 1u; i < nodes.size(); i += 2) {
-    auto ope = nodes[i + 0]->token[0];
-    auto rval = compile_switch_value(nodes[i + 1]);
-    switch (ope) {
-      case '*':
-        val = builder_.CreateMul(val, rval, "mul");
-        break;
-      case '/': {
-        // Zero divide check
-        auto cond = builder_.CreateICmpEQ(rval, builder_.getInt32(0), "icmpeq");
-
-        auto fn = builder_.GetInsertBlock()->getParent();
-        auto ifZeroBB = BasicBlock::Create(context_, "zdiv.zero", fn);
-        auto ifNonZeroBB = BasicBlock::Create(context_, "zdiv.non_zero");
-        builder_.CreateCondBr(cond, ifZeroBB, ifNonZeroBB);
-
-        // zero
-        {
-          builder_.SetInsertPoint(ifZeroBB);
-
-          Value* eh = nullptr;
-          {
-            auto fn = cast<Function>(
-                module_
-                    ->getOrInsertFunction("__cxa_allocate_exception",
-                                          builder_.getPtrTy(),
-                                          builder_.getInt64Ty())
-                    .getCallee());
-
-            eh = builder_.CreateCall(fn, builder_.getInt64(8), "eh");
-
-            auto payload = builder_.CreateBitCast(eh, builder_.getPtrTy(), "payload");
-
-            auto msg = builder_.CreateGlobalStringPtr(
-                "divide by 0", ".str.zero_divide", 0, module_.get());
-
-            builder_.CreateStore(msg, payload);
-          }
-
-          {
-            auto fn = cast<Function>(
-                module_
-                    ->getOrInsertFunction("__cxa_throw", builder_.getVoidTy(),
-                                          builder_.getPtrTy(),
-                                          builder_.getPtrTy(),
-                                          builder_.getPtrTy())
-                    .getCallee());
-
-            builder_.CreateCall(
-                fn,
-                {eh, ConstantExpr::getBitCast(tyinfo_, builder_.getPtrTy()),
-                 ConstantPointerNull::get(builder_.getPtrTy())});
-          }
-
-          builder_.CreateUnreachable();
-        }
-
-        // no_zero
-        {
-          ifNonZeroBB->insertInto(fn);
-          builder_.SetInsertPoint(ifNonZeroBB);
-          val = builder_.CreateSDiv(val, rval, "div");
-        }
-        break;
-      }
+Value* JITCompiler::compile_expression(ir::Index index) {
+  const auto& expr = program_->exprs[index];
+  switch (expr.kind) {
+    case ir::ExprKind::number:
+      return builder_.getInt32(static_cast<uint32_t>(expr.value));
+    case ir::ExprKind::variable: {
+      auto var = compile_variable(expr.decl);
+      return builder_.CreateLoad(builder_.getInt32Ty(), var);
+    }
+    case ir::ExprKind::element: {
+      auto subscript = compile_expression(expr.lhs);
+      return builder_.CreateLoad(builder_.getInt32Ty(),
+                                 compile_element(expr.decl, subscript));
     }
+    case ir::ExprKind::neg:
+      return builder_.CreateNeg(compile_expression(expr.lhs), "negative");
+    default:
+      break;
+  }
+
+  auto lhs = compile_expression(expr.lhs);
+  auto rhs = compile_expression(expr.rhs);
+  switch (expr.kind) {
+    case ir::ExprKind::add:
+      return builder_.CreateAdd(lhs, rhs, "add");
+    case ir::ExprKind::sub:
+      return builder_.CreateSub(lhs, rhs, "sub");
+    case ir::ExprKind::mul:
+      return builder_.CreateMul(lhs, rhs, "mul");
+    case ir::ExprKind::div:
+      return compile_divide(lhs, rhs);
+    case ir::ExprKind::div_nonzero:
+      return builder_.CreateSDiv(lhs, rhs, "div");
+    default:
+      return nullptr;
   }
-  return val;
 }
 
-Value* JITCompiler::compile_factor(const std::shared_ptr<AstPL0> ast) {
-  return compile_switch_value(ast->nodes[0]);
+Value* JITCompiler::compile_divide(Value* val, Value* rval) {
+  // Zero divide check
+  auto cond = builder_.CreateICmpEQ(rval, builder_.getInt32(0), "icmpeq");
+
+  auto fn = builder_.GetInsertBlock()->getParent();
+  auto ifZeroBB = BasicBlock::Create(context_, "zdiv.zero", fn);
+  auto ifNonZeroBB = BasicBlock::Create(context_, "zdiv.non_zero");
+  builder_.CreateCondBr(cond, ifZeroBB, ifNonZeroBB);
+
+  // zero
+  builder_.SetInsertPoint(ifZeroBB);
+  compile_error("divide by 0", ".str.zero_divide");
+
+  // no_zero
+  ifNonZeroBB->insertInto(fn);
+  builder_.SetInsertPoint(ifNonZeroBB);
+  return builder_.CreateSDiv(val, rval, "div");
 }
 
-Value* JITCompiler::compile_ident(const std::shared_ptr<AstPL0> ast) {
-  auto ident = ast->token;
+Value* JITCompiler::compile_element(ir::Index decl, Value* index) {
+  // The unsigned compare also rules out negative indices. It doesn't
+  // depend on memory, so loop passes can take it out of a loop whose
+  // index stays in range (IRCE), which leaves the loop free to vectorize.
+  auto size = program_->decls[decl].size;
+  auto cond =
+      builder_.CreateICmpULT(index, builder_.getInt32(size), "inbounds");
 
   auto fn = builder_.GetInsertBlock()->getParent();
-  auto tbl = fn->getValueSymbolTable();
-  auto var = tbl->lookup(ident);
-  if (!var) {
-    throw_runtime_error(ast,
-                        "'" + std::string(ident) + "' is not defined...");
+  auto outBB = BasicBlock::Create(context_, "bounds.out", fn);
+  auto inBB = BasicBlock::Create(context_, "bounds.in");
+  builder_.CreateCondBr(cond, inBB, outBB,
+                        MDBuilder(context_).createBranchWeights(1 << 20, 1));
+
+  builder_.SetInsertPoint(outBB);
+  compile_error("index out of range", ".str.index_out_of_range");
+
+  inBB->insertInto(fn);
+  builder_.SetInsertPoint(inBB);
+  return builder_.CreateInBoundsGEP(
+      builder_.getInt32Ty(), compile_variable(decl),
+      builder_.CreateZExt(index, builder_.getInt64Ty()), "element");
+}
+
+void JITCompiler::compile_fuel(ir::Location loc) {
+  // Take a unit, or stop the program at `loc` when there's none left. The
+  // counter is an internal global that nothing else reads, so in a loop
+  // without calls it stays in a register.
+  auto fuel = builder_.CreateLoad(builder_.getInt64Ty(), fuel_, "fuel");
+  auto empty = builder_.CreateICmpEQ(fuel, builder_.getInt64(0), "empty");
+
+  auto fn = builder_.GetInsertBlock()->getParent();
+  auto outBB = BasicBlock::Create(context_, "fuel.out", fn);
+  auto okBB = BasicBlock::Create(context_, "fuel.ok");
+  builder_.CreateCondBr(empty, outBB, okBB,
+                        MDBuilder(context_).createBranchWeights(1, 1 << 20));
+
+  builder_.SetInsertPoint(outBB);
+  auto msg = "out of fuel at " + std::to_string(loc.line) + ":" +
+             std::to_string(loc.column);
+  compile_error(msg.c_str(), ".str.out_of_fuel");
+
+  okBB->insertInto(fn);
+  builder_.SetInsertPoint(okBB);
+  builder_.CreateStore(builder_.CreateSub(fuel, builder_.getInt64(1)), fuel_);
+}
+
+void JITCompiler::compile_error(const char* msg, const char* name) {
+  if (options_.fast_fail) {
+    auto str = builder_.CreateGlobalStringPtr(msg, name, 0, module_.get());
+    builder_.CreateCall(module_->getFunction("__pl0_error"), str);
+    builder_.CreateUnreachable();
+    return;
+  }
+
+  // Throw the message like the runtime does
+  Value* eh = nullptr;
+  {
+    auto fn = cast<Function>(
+        module_
+            ->getOrInsertFunction("__cxa_allocate_exception",
+                                  builder_.getPtrTy(), builder_.getInt64Ty())
+            .getCallee());
+
+    eh = builder_.CreateCall(fn, builder_.getInt64(8), "eh");
+
+    auto payload = builder_.CreateBitCast(eh, builder_.getPtrTy(), "payload");
+
+    auto str = builder_.CreateGlobalStringPtr(msg, name, 0, module_.get());
+
+    builder_.CreateStore(str, payload);
   }
 
-  return builder_.CreateLoad(builder_.getInt32Ty(), var);
+  {
+    auto fn = cast<Function>(
+        module_
+            ->getOrInsertFunction("__cxa_throw", builder_.getVoidTy(),
+                                  builder_.getPtrTy(), builder_.getPtrTy(),
+                                  builder_.getPtrTy())
+            .getCallee());
+
+    builder_.CreateCall(
+        fn, {eh, ConstantExpr::getBitCast(tyinfo_, builder_.getPtrTy()),
+             ConstantPointerNull::get(builder_.getPtrTy())});
+  }
+
+  builder_.CreateUnreachable();
+}
+
+Value* JITCompiler::compile_variable(ir::Index decl) {
+  if (!options_.frames) {
+    return values_[decl];
+  }
+
+  // The frame of the declaring block
+  auto block = program_->decls[decl].block;
+  auto frame = frame_;
+  while (frame->block != block) {
+    frame = frame->outer;
+  }
+  auto slot = program_->slot(decl);
+  if (frame == frame_ || !frame->outer) {
+    return frame->variables[slot];
+  }
+  return builder_.CreateStructGEP(
+      frame->type, compile_record(frame), frame->fields[slot],
+      program_->name(program_->decls[decl].name));
 }
 
-Value* JITCompiler::compile_number(const std::shared_ptr<AstPL0> ast) {
-  return ConstantInt::getIntegerValue(builder_.getInt32Ty(),
-                                      APInt(32, ast->token, 10));
+Value* JITCompiler::compile_record(const Frame* frame) {
+  if (frame == frame_) {
+    return frame_->record;
+  }
+
+  // Follow the static links up to the block
+  auto record = frame_->link;
+  for (auto outer = frame_->outer; outer != frame; outer = outer->outer) {
+    auto slot = builder_.CreateStructGEP(outer->type, record, 0);
+    record = builder_.CreateLoad(outer->link->getType(), slot, "link");
+  }
+  return record;
 }
 
 }  // namespace pl0
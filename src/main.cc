@@ -5,63 +5,421 @@
 //  MIT License
 //
 
+#include "batch.h"
 #include "grammar.h"
+#include "interpreter.h"
+#include "ir.h"
 #include "jit_compiler.h"
+#include "memo_analysis.h"
+#include "object_cache.h"
+#include "range_analysis.h"
+#include "runtime.h"
+#include "server.h"
+#include "stats.h"
 #include "symbol_table.h"
 #include "utils.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include <peglib.h>
 
-#include <fstream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <iostream>
-#include <vector>
+#include <string_view>
+#include <thread>
 
 using namespace pl0;
 using namespace peg;
 
-int main(int argc, const char** argv) {
-  if (argc < 2) {
-    std::cout << "usage: pl0 file" << std::endl;
-    return 1;
+static void usage() {
+  std::cout << "usage: pl0 [options] file" << std::endl
+            << "       pl0 --serve SOCKET" << std::endl
+            << "       pl0 --client SOCKET [options] file" << std::endl
+            << "       pl0 --batch [options] dir" << std::endl
+            << "  -O0|-O1|-O2|-O3   optimization level (default -O2)"
+            << std::endl
+            << "  --eager           compile all procedures before running"
+            << std::endl
+            << "  -j N              compile on N threads (implies --eager)"
+            << std::endl
+            << "  --frames          pass outer variables through frame records"
+            << " and static links" << std::endl
+            << "  --fast-fail       end the program on runtime errors without"
+            << " unwinding (jit mode)" << std::endl
+            << "  --memo            cache results of pure procedures (jit mode)"
+            << std::endl
+            << "  --memo-size N     entries per memo table (default 4096,"
+            << " at most 2^24, implies --memo)" << std::endl
+            << "  --profile         report calls, cycles and loop iterations"
+            << " per procedure (jit mode)" << std::endl
+            << "  --profile-json FILE" << std::endl
+            << "                    also write the profile as JSON (implies"
+            << " --profile)" << std::endl
+            << "  --profile-out FILE" << std::endl
+            << "                    record call, loop and IF counts for"
+            << " --profile-use (jit mode)" << std::endl
+            << "  --profile-use FILE" << std::endl
+            << "                    optimize with counts recorded by"
+            << " --profile-out" << std::endl
+            << "  --fuel N          stop after N loop iterations plus calls"
+            << " (jit mode)" << std::endl
+            << "  --perf-map        list JIT compiled functions in"
+            << " /tmp/perf-PID.map for perf" << std::endl
+            << "  --jitdump         write a jitdump file for perf inject"
+            << std::endl
+            << "  --gdb             register JIT compiled code with gdb"
+            << std::endl
+            << "  --mode MODE       jit, interp or tiered (default jit)"
+            << std::endl
+            << "  --hot N           calls plus loop iterations before a"
+            << " procedure is JIT compiled in tiered mode (default 1000)"
+            << std::endl
+            << "  --cache DIR       cache compiled objects in DIR"
+            << " (default $PL0_CACHE_DIR)" << std::endl
+            << "  --cache-stats     print object cache counters" << std::endl
+            << "  --stats           print time, CPU and peak RSS per phase"
+            << std::endl
+            << "  --trace FILE      write phases as Chrome trace events"
+            << std::endl
+            << "  --emit-obj FILE   write a native object and exit" << std::endl
+            << "  --emit-exe FILE   write an executable and exit" << std::endl
+            << "  --emit-asm FILE   write optimized assembly and exit"
+            << std::endl
+            << "  --emit-llvm FILE  write optimized LLVM IR and exit"
+            << std::endl
+            << "  --emit-llvm-pre FILE" << std::endl
+            << "                    write LLVM IR before optimization and exit"
+            << std::endl
+            << "  --serve SOCKET    keep the parser and LLVM warm and run"
+            << " programs sent by --client" << std::endl
+            << "  --client SOCKET   run the program in a --serve process"
+            << std::endl
+            << "  --batch           run every .pas file in dir on -j threads"
+            << " (default: all cores)" << std::endl;
+}
+
+static std::unique_ptr<parser> make_parser() {
+  auto p = std::make_unique<parser>(grammar);
+  p->enable_ast<AstPL0>();
+  return p;
+}
+
+// Parse command line options; the path is null when they are invalid
+static const char* parse_options(int argc, const char** argv,
+                                 Options& options) {
+  if (auto dir = std::getenv("PL0_CACHE_DIR")) {
+    options.cache_dir = dir;
+  }
+
+  const char* path = nullptr;
+  auto jobs = false;
+  for (auto i = 1; i < argc; i++) {
+    auto arg = argv[i];
+    if (!std::strncmp(arg, "-O", 2) && arg[2] >= '0' && arg[2] <= '3' &&
+        !arg[3]) {
+      options.opt_level = arg[2] - '0';
+    } else if (!std::strcmp(arg, "--eager")) {
+      options.lazy = false;
+    } else if (!std::strcmp(arg, "-j") && i + 1 < argc) {
+      options.jobs = static_cast<unsigned>(
+          std::max(1ul, std::strtoul(argv[++i], nullptr, 10)));
+      jobs = true;
+    } else if (!std::strncmp(arg, "-j", 2) && arg[2]) {
+      options.jobs = static_cast<unsigned>(
+          std::max(1ul, std::strtoul(arg + 2, nullptr, 10)));
+      jobs = true;
+    } else if (!std::strcmp(arg, "--fast-fail")) {
+      options.fast_fail = true;
+    } else if (!std::strcmp(arg, "--frames")) {
+      options.frames = true;
+    } else if (!std::strcmp(arg, "--memo")) {
+      options.memo = true;
+    } else if (!std::strcmp(arg, "--memo-size") && i + 1 < argc) {
+      options.memo = true;
+      options.memo_size = static_cast<unsigned>(
+          std::clamp(std::strtoul(argv[++i], nullptr, 10), 1ul,
+                     static_cast<unsigned long>(Options::max_memo_size)));
+    } else if (!std::strcmp(arg, "--profile")) {
+      options.profile = true;
+    } else if (!std::strcmp(arg, "--profile-json") && i + 1 < argc) {
+      options.profile = true;
+      options.profile_json = argv[++i];
+    } else if (!std::strcmp(arg, "--profile-out") && i + 1 < argc) {
+      options.profile_out = argv[++i];
+    } else if (!std::strncmp(arg, "--profile-out=", 14)) {
+      options.profile_out = arg + 14;
+    } else if (!std::strcmp(arg, "--profile-use") && i + 1 < argc) {
+      options.profile_use = argv[++i];
+    } else if (!std::strncmp(arg, "--profile-use=", 14)) {
+      options.profile_use = arg + 14;
+    } else if (!std::strcmp(arg, "--fuel") && i + 1 < argc) {
+      options.fuel = std::strtoull(argv[++i], nullptr, 10);
+    } else if (!std::strcmp(arg, "--perf-map")) {
+      options.perf_map = true;
+    } else if (!std::strcmp(arg, "--jitdump")) {
+      options.jitdump = true;
+    } else if (!std::strcmp(arg, "--gdb")) {
+      options.gdb = true;
+    } else if (!std::strcmp(arg, "--mode") && i + 1 < argc) {
+      auto mode = argv[++i];
+      if (!std::strcmp(mode, "jit")) {
+        options.mode = Mode::jit;
+      } else if (!std::strcmp(mode, "interp")) {
+        options.mode = Mode::interp;
+      } else if (!std::strcmp(mode, "tiered")) {
+        options.mode = Mode::tiered;
+      } else {
+        return nullptr;
+      }
+    } else if (!std::strcmp(arg, "--hot") && i + 1 < argc) {
+      options.hot_threshold =
+          static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (!std::strcmp(arg, "--cache") && i + 1 < argc) {
+      options.cache_dir = argv[++i];
+    } else if (!std::strcmp(arg, "--cache-stats")) {
+      options.cache_stats = true;
+    } else if (!std::strcmp(arg, "--stats")) {
+      options.stats = true;
+    } else if (!std::strcmp(arg, "--trace") && i + 1 < argc) {
+      options.trace = argv[++i];
+    } else if (!std::strncmp(arg, "--trace=", 8)) {
+      options.trace = arg + 8;
+    } else if (!std::strcmp(arg, "--emit-obj") && i + 1 < argc) {
+      options.emit_obj = argv[++i];
+    } else if (!std::strcmp(arg, "--emit-exe") && i + 1 < argc) {
+      options.emit_exe = argv[++i];
+    } else if (!std::strcmp(arg, "--emit-asm") && i + 1 < argc) {
+      options.emit_asm = argv[++i];
+    } else if (!std::strcmp(arg, "--emit-llvm") && i + 1 < argc) {
+      options.emit_llvm = argv[++i];
+    } else if (!std::strcmp(arg, "--emit-llvm-pre") && i + 1 < argc) {
+      options.emit_llvm_pre = argv[++i];
+    } else if (!std::strcmp(arg, "--batch")) {
+      options.batch = true;
+    } else if (arg[0] != '-' && !path) {
+      path = arg;
+    } else {
+      return nullptr;
+    }
+  }
+
+  if (options.batch) {
+    // Programs run on their own threads, so whatever the runtime or the
+    // statistics keep for the whole process can't be used
+    if (options.compile_only() || options.stats || !options.trace.empty() ||
+        options.counting() || !options.profile_json.empty() ||
+        options.memo || options.fast_fail) {
+      return nullptr;
+    }
+    if (!jobs) {
+      options.jobs = std::max(1u, std::thread::hardware_concurrency());
+    }
   }
+  return path;
+}
 
-  // Source file path
-  auto path = argv[1];
+// Compile and run a program. `warm` is a parser prepared by the server (or
+// a batch worker) and diagnostics go to `err`.
+static int run(const Options& options, const char* path, parser* warm,
+               std::ostream& err) {
+  if (options.stats || !options.trace.empty()) {
+    Stats::enable();
+  }
 
-  // Read a source file into memory
-  std::vector<char> source;
-  std::ifstream ifs(path, std::ios::in | std::ios::binary);
-  if (ifs.fail()) {
-    std::cerr << "can't open the source file." << std::endl;
+  // Map the source file (small files are read). The AST tokens point into
+  // this buffer, so it has to outlive the AST and the lowering (but not the
+  // execution).
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer = nullptr;
+  {
+    Stats::Phase phase("read");
+    buffer = llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                         /*RequiresNullTerminator=*/false);
+  }
+  if (!buffer) {
+    err << "can't open the source file." << std::endl;
     return -1;
   }
+  std::string_view source = (*buffer)->getBuffer();
+
+  // A cached object skips parsing and code generation entirely
+  std::unique_ptr<ObjectFileCache> cache;
+  std::string key;
+  if (!options.cache_dir.empty() && !options.compile_only() &&
+      options.mode == Mode::jit) {
+    cache = std::make_unique<ObjectFileCache>(options.cache_dir);
+    key = ObjectFileCache::key(source, options);
+  }
+
+  auto report = [&]() {
+    if (cache && options.cache_stats) {
+      err << "cache: " << cache->hits << " hits, " << cache->misses
+          << " misses, " << cache->stores << " stores" << std::endl;
+    }
+    if (options.stats) {
+      Stats::print(err);
+      if (options.memo) {
+        __pl0_memo_report();
+      }
+    }
+    if (options.mode == Mode::jit && !options.compile_only()) {
+      if (options.profile) {
+        __pl0_profile_report();
+      }
+      if (!options.profile_json.empty() &&
+          !__pl0_profile_write(options.profile_json.c_str())) {
+        err << "can't write the profile file." << std::endl;
+      }
+      if (!options.profile_out.empty() &&
+          !__pl0_profile_write_counts(options.profile_out.c_str())) {
+        err << "can't write the profile data." << std::endl;
+      }
+    }
+    if (!options.trace.empty() && !Stats::write_trace(options.trace)) {
+      err << "can't write the trace file." << std::endl;
+    }
+  };
 
-  source.resize(static_cast<unsigned int>(ifs.seekg(0, std::ios::end).tellg()));
-  if (!source.empty()) {
-    ifs.seekg(0, std::ios::beg)
-        .read(&source[0], static_cast<std::streamsize>(source.size()));
+  if (cache) {
+    std::unique_ptr<llvm::MemoryBuffer> object;
+    {
+      Stats::Phase phase("cache");
+      object = cache->load(key);
+    }
+    if (object) {
+      try {
+        JITCompiler::run(std::move(object), options);
+      } catch (const std::runtime_error& e) {
+        err << e.what() << std::endl;
+      }
+      report();
+      return 0;
+    }
   }
 
   // Setup a PEG parser
-  parser parser(grammar);
-  parser.enable_ast<AstPL0>();
+  std::unique_ptr<parser> local;
+  if (!warm) {
+    local = make_parser();
+    warm = local.get();
+  }
+  auto& parser = *warm;
   parser.set_logger([&](size_t ln, size_t col, const std::string& msg) {
-    std::cerr << format_error_message(path, ln, col, msg) << std::endl;
+    err << format_error_message(path, ln, col, msg) << std::endl;
   });
 
   // Parse the source and make an AST
   std::shared_ptr<AstPL0> ast;
-  if (parser.parse_n(source.data(), source.size(), ast, path)) {
+  bool parsed;
+  {
+    Stats::Phase phase("parse");
+    parsed = parser.parse_n(source.data(), source.size(), ast, path);
+  }
+  if (parsed) {
+    if (Stats::enabled()) {
+      std::function<uint64_t(const AstPL0&)> count = [&](const AstPL0& node) {
+        uint64_t n = 1;
+        for (const auto& child : node.nodes) {
+          n += count(*child);
+        }
+        return n;
+      };
+      Stats::count("ast nodes", count(*ast));
+    }
+
     try {
-      // Make a symbol table on the AST
-      SymbolTableBuilder::build_on_ast(ast);
+      // Lower the AST into the compact form the later passes work on
+      Program program;
+      {
+        Stats::Phase phase("lower");
+        program = Program::lower(*ast);
+      }
+      Stats::count("ir nodes", program.size());
+
+      // Names are copied out of the source, so the AST, the parser and the
+      // source go before the program is compiled and run
+      ast.reset();
+      local.reset();
+      buffer->reset();
+      trim_heap();
+
+      // Check and resolve symbols
+      {
+        Stats::Phase phase("symbols");
+        SymbolTableBuilder::build(program);
+      }
+
+      // Drop zero checks of divisors that can't be zero
+      {
+        Stats::Phase phase("ranges");
+        RangeAnalysis::run(program);
+      }
+
+      // Find procedures whose calls can be cached
+      if (options.memo && options.mode == Mode::jit) {
+        Stats::Phase phase("memo");
+        MemoAnalysis::run(program);
+      }
 
-      // JIT compile and execute
-      JITCompiler::run(ast);
+      if (options.compile_only()) {
+        // Compile ahead of time
+        JITCompiler::emit(program, options);
+      } else if (options.mode != Mode::jit) {
+        // Interpret, promoting hot procedures in tiered mode
+        Interpreter::run(program, options);
+      } else {
+        // JIT compile and execute (the program is freed once its IR exists)
+        JITCompiler::run(std::move(program), options, cache.get(), key);
+      }
     } catch (const std::runtime_error& e) {
-      std::cerr << e.what() << std::endl;
+      err << e.what() << std::endl;
     }
+    report();
     return 0;
   }
 
+  report();
   return -1;
 }
+
+int main(int argc, const char** argv) {
+  if (argc >= 3 && !std::strcmp(argv[1], "--client")) {
+    return client(argv[2], argc - 3, argv + 3);
+  }
+
+  if (argc == 3 && !std::strcmp(argv[1], "--serve")) {
+    // Everything that doesn't depend on the program is set up once; each
+    // request runs in a child process that inherits it
+    auto parser = make_parser();
+    JITCompiler::initialize();
+    return serve(argv[2], [&](int request_argc, const char** request_argv) {
+      Options options;
+      auto path = parse_options(request_argc, request_argv, options);
+      if (!path) {
+        usage();
+        return 1;
+      }
+      return run(options, path, parser.get(), std::cerr);
+    });
+  }
+
+  Options options;
+  auto path = parse_options(argc, argv, options);
+  if (!path) {
+    usage();
+    return 1;
+  }
+
+  if (options.batch) {
+    // The threads run the programs, each one compiled on its own thread
+    JITCompiler::initialize();
+    auto jobs = options.jobs;
+    options.jobs = 1;
+    return batch(path, jobs, [&](const std::string& file, std::ostream& err) {
+      // Each worker keeps its parser for all of its programs
+      thread_local auto parser = make_parser();
+      return run(options, file.c_str(), parser.get(), err);
+    });
+  }
+  return run(options, path, nullptr, std::cerr);
+}
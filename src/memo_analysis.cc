@@ -0,0 +1,173 @@
+#include "memo_analysis.h"
+#include "stats.h"
+
+namespace pl0 {
+
+using namespace ir;
+
+void MemoAnalysis::run(Program& program) {
+  MemoAnalysis analysis(program);
+  do {
+    analysis.changed_ = false;
+    for (auto i = 1u; i < program.blocks.size(); i++) {
+      analysis.block(i);
+    }
+  } while (analysis.changed_);
+
+  uint64_t count = 0;
+  for (auto i = 1u; i < program.blocks.size(); i++) {
+    auto& block = program.blocks[i];
+    const auto& reads = analysis.reads_[i];
+    const auto& writes = analysis.writes_[i];
+    if (analysis.io_[i] || !analysis.work_[i] || writes.empty()) {
+      continue;
+    }
+    block.memo = true;
+    block.inputs = {static_cast<Index>(program.lists.size()),
+                    static_cast<uint32_t>(reads.size())};
+    program.lists.insert(program.lists.end(), reads.begin(), reads.end());
+    block.outputs = {static_cast<Index>(program.lists.size()),
+                     static_cast<uint32_t>(writes.size())};
+    program.lists.insert(program.lists.end(), writes.begin(), writes.end());
+    count++;
+  }
+  Stats::count("memoized procedures", count);
+}
+
+MemoAnalysis::MemoAnalysis(Program& program)
+    : program_(program),
+      io_(program.blocks.size()),
+      work_(program.blocks.size()),
+      reads_(program.blocks.size()),
+      writes_(program.blocks.size()) {}
+
+void MemoAnalysis::block(Index index) {
+  std::set<Index> defs;
+  statement(index, program_.blocks[index].body, defs);
+}
+
+// `defs` are the variables written on every path so far; reading anything
+// else reads the value the block was entered with
+void MemoAnalysis::statement(Index block, Index index,
+                             std::set<Index>& defs) {
+  const auto& stmt = program_.stmts[index];
+  switch (stmt.kind) {
+    case StmtKind::empty:
+      break;
+    case StmtKind::assignment:
+      if (stmt.index != kNone) {
+        expression(block, stmt.index, defs);
+      }
+      expression(block, stmt.expr, defs);
+      write(block, stmt.target);
+      // Writing an element leaves the rest of the array as it was
+      if (stmt.index == kNone) {
+        defs.insert(stmt.target);
+      }
+      break;
+    case StmtKind::call: {
+      work_[block] = true;
+      if (io_[stmt.target] && !io_[block]) {
+        io_[block] = true;
+        changed_ = true;
+      }
+      // What the callee reads and writes of the variables visible here;
+      // its own variables and those of blocks it re-enters are new
+      for (auto decl : reads_[stmt.target]) {
+        if (program_.decls[decl].block != block) {
+          read(block, decl, defs);
+        }
+      }
+      for (auto decl : writes_[stmt.target]) {
+        if (program_.decls[decl].block != block) {
+          write(block, decl);
+        }
+      }
+      break;
+    }
+    case StmtKind::statements:
+      for (auto i = 0u; i < stmt.count; i++) {
+        statement(block, program_.lists[stmt.first + i], defs);
+      }
+      break;
+    case StmtKind::if_:
+    case StmtKind::while_: {
+      if (stmt.kind == StmtKind::while_) {
+        work_[block] = true;
+      }
+      expression(block, stmt.expr, defs);
+      // The body may not run, so its writes don't count afterwards
+      auto inner = defs;
+      statement(block, stmt.body, inner);
+      break;
+    }
+    case StmtKind::out:
+    case StmtKind::in:
+      if (!io_[block]) {
+        io_[block] = true;
+        changed_ = true;
+      }
+      if (stmt.kind == StmtKind::out) {
+        expression(block, stmt.expr, defs);
+      } else {
+        if (stmt.index != kNone) {
+          expression(block, stmt.index, defs);
+        }
+        write(block, stmt.target);
+      }
+      break;
+  }
+}
+
+void MemoAnalysis::expression(Index block, Index index,
+                              const std::set<Index>& defs) {
+  const auto& expr = program_.exprs[index];
+  switch (expr.kind) {
+    case ExprKind::number:
+      break;
+    case ExprKind::variable:
+      read(block, expr.decl, defs);
+      break;
+    case ExprKind::element:
+      read(block, expr.decl, defs);
+      expression(block, expr.lhs, defs);
+      break;
+    case ExprKind::neg:
+    case ExprKind::odd:
+      expression(block, expr.lhs, defs);
+      break;
+    default:
+      expression(block, expr.lhs, defs);
+      expression(block, expr.rhs, defs);
+      break;
+  }
+}
+
+void MemoAnalysis::read(Index block, Index decl, const std::set<Index>& defs) {
+  // The block's own variables start out undefined on every call
+  if (program_.decls[decl].block != block && !defs.count(decl) &&
+      reads_[block].insert(decl).second) {
+    changed_ = true;
+  }
+  outer_array(block, decl);
+}
+
+void MemoAnalysis::write(Index block, Index decl) {
+  if (program_.decls[decl].block != block &&
+      writes_[block].insert(decl).second) {
+    changed_ = true;
+  }
+  outer_array(block, decl);
+}
+
+void MemoAnalysis::outer_array(Index block, Index decl) {
+  // A memo table entry only holds scalars, so a procedure using an outer
+  // array is treated like one doing input or output
+  if (program_.decls[decl].size && program_.decls[decl].block != block &&
+      !io_[block]) {
+    io_[block] = true;
+    changed_ = true;
+  }
+}
+
+}  // namespace pl0
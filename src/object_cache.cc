@@ -0,0 +1,107 @@
+#include "object_cache.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA256.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace pl0 {
+
+using namespace llvm;
+
+// Bump when the generated code changes in a way the key doesn't capture
+static constexpr auto cache_format = "pl0-object-11";
+
+ObjectFileCache::ObjectFileCache(const std::string& dir) : dir_(dir) {}
+
+std::string ObjectFileCache::key(std::string_view source,
+                                 const Options& options) {
+  SHA256 hash;
+  hash.update(cache_format);
+  hash.update(LLVM_VERSION_STRING);
+
+  hash.update(StringRef(source.data(), source.size()));
+  hash.update(std::to_string(source.size()));
+  hash.update("-O" + std::to_string(options.opt_level));
+  hash.update(options.frames ? "frames" : "args");
+  hash.update(options.fast_fail ? "fast-fail" : "unwind");
+  hash.update(options.memo ? "memo" + std::to_string(options.memo_size)
+                           : "no-memo");
+  hash.update("fuel" + std::to_string(options.fuel));
+  hash.update(options.profile      ? "profile"
+              : options.counting() ? "counts"
+                                   : "no-profile");
+  if (!options.profile_use.empty()) {
+    // The counts, not the file name
+    auto profile = MemoryBuffer::getFile(options.profile_use);
+    hash.update(profile ? (*profile)->getBuffer() : "no-profile-data");
+  }
+
+  auto jtmb = orc::JITTargetMachineBuilder::detectHost();
+  if (jtmb) {
+    hash.update(jtmb->getTargetTriple().str());
+    hash.update(jtmb->getCPU());
+    hash.update(jtmb->getFeatures().getString());
+  } else {
+    consumeError(jtmb.takeError());
+  }
+
+  return toHex(hash.final(), true);
+}
+
+std::string ObjectFileCache::path(const std::string& key) const {
+  SmallString<128> path(dir_);
+  sys::path::append(path, key + ".o");
+  return std::string(path);
+}
+
+std::unique_ptr<MemoryBuffer> ObjectFileCache::load(const std::string& key) {
+  auto buf = MemoryBuffer::getFile(path(key));
+  if (!buf) {
+    misses++;
+    return nullptr;
+  }
+  hits++;
+  return std::move(*buf);
+}
+
+void ObjectFileCache::notifyObjectCompiled(const Module* module,
+                                           MemoryBufferRef object) {
+  if (sys::fs::create_directories(dir_)) {
+    return;
+  }
+
+  // Write to a temporary file and rename it, so concurrent runs never see a
+  // partially written object
+  int fd;
+  SmallString<128> tmp;
+  if (sys::fs::createUniqueFile(dir_ + "/%%%%%%%%.tmp", fd, tmp)) {
+    return;
+  }
+  {
+    raw_fd_ostream os(fd, true);
+    os << object.getBuffer();
+    // Flush before checking, a failed flush in the destructor is fatal
+    os.close();
+    if (os.has_error()) {
+      os.clear_error();
+      sys::fs::remove(tmp);
+      return;
+    }
+  }
+  if (sys::fs::rename(tmp, path(module->getModuleIdentifier()))) {
+    sys::fs::remove(tmp);
+    return;
+  }
+  stores++;
+}
+
+std::unique_ptr<MemoryBuffer> ObjectFileCache::getObject(const Module* module) {
+  auto buf = MemoryBuffer::getFile(path(module->getModuleIdentifier()));
+  return buf ? std::move(*buf) : nullptr;
+}
+
+}  // namespace pl0
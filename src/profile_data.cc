@@ -0,0 +1,63 @@
+#include "profile_data.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace pl0 {
+
+ProfileData ProfileData::load(const std::string& path) {
+  std::ifstream ifs(path);
+  if (!ifs) {
+    throw std::runtime_error("can't open the profile '" + path + "'...");
+  }
+
+  ProfileData data;
+  std::string line;
+  if (!std::getline(ifs, line) || line != "pl0-profile 1") {
+    throw std::runtime_error("'" + path + "' isn't a profile...");
+  }
+
+  for (size_t number = 2; std::getline(ifs, line); number++) {
+    std::istringstream is(line);
+    std::string kind, name, location;
+    is >> kind >> name;
+    size_t counts = 0;
+    if (kind == "proc") {
+      counts = 1;
+    } else if (kind == "loop" || kind == "if") {
+      is >> location;
+      counts = 2;
+    }
+
+    std::vector<uint64_t> values(counts);
+    for (auto& value : values) {
+      is >> value;
+    }
+    if (!counts || !is || !(is >> std::ws).eof()) {
+      throw std::runtime_error(path + ":" + std::to_string(number) +
+                               ": invalid profile entry...");
+    }
+
+    auto key = kind + " " + name;
+    if (!location.empty()) {
+      key += " " + location;
+    }
+    data.sites_[key] = std::move(values);
+  }
+  return data;
+}
+
+const std::vector<uint64_t>* ProfileData::find(const std::string& key) const {
+  auto it = sites_.find(key);
+  return it != sites_.end() ? &it->second : nullptr;
+}
+
+std::vector<uint64_t> ProfileData::counts() const {
+  std::vector<uint64_t> counts;
+  for (const auto& [key, values] : sites_) {
+    counts.insert(counts.end(), values.begin(), values.end());
+  }
+  return counts;
+}
+
+}  // namespace pl0
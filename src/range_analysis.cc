@@ -0,0 +1,265 @@
+#include "range_analysis.h"
+#include "stats.h"
+#include <algorithm>
+#include <iterator>
+
+namespace pl0 {
+
+using namespace ir;
+
+namespace {
+
+bool contains(const std::vector<Index>& facts, Index decl) {
+  return std::binary_search(facts.begin(), facts.end(), decl);
+}
+
+void insert(std::vector<Index>& facts, Index decl) {
+  auto it = std::lower_bound(facts.begin(), facts.end(), decl);
+  if (it == facts.end() || *it != decl) {
+    facts.insert(it, decl);
+  }
+}
+
+void erase(std::vector<Index>& facts, Index decl) {
+  auto it = std::lower_bound(facts.begin(), facts.end(), decl);
+  if (it != facts.end() && *it == decl) {
+    facts.erase(it);
+  }
+}
+
+// Comparison with the operands swapped (`0 < n` is `n > 0`)
+ExprKind mirror(ExprKind kind) {
+  switch (kind) {
+    case ExprKind::lt:
+      return ExprKind::gt;
+    case ExprKind::le:
+      return ExprKind::ge;
+    case ExprKind::gt:
+      return ExprKind::lt;
+    case ExprKind::ge:
+      return ExprKind::le;
+    default:
+      return kind;
+  }
+}
+
+// Comparison that holds when `kind` doesn't
+ExprKind negate(ExprKind kind) {
+  switch (kind) {
+    case ExprKind::eq:
+      return ExprKind::ne;
+    case ExprKind::ne:
+      return ExprKind::eq;
+    case ExprKind::lt:
+      return ExprKind::ge;
+    case ExprKind::le:
+      return ExprKind::gt;
+    case ExprKind::gt:
+      return ExprKind::le;
+    case ExprKind::ge:
+      return ExprKind::lt;
+    default:
+      return kind;
+  }
+}
+
+// Whether `v <kind> c` rules out v == 0
+bool excludes_zero(ExprKind kind, int32_t c) {
+  switch (kind) {
+    case ExprKind::eq:
+      return c != 0;
+    case ExprKind::ne:
+      return c == 0;
+    case ExprKind::lt:
+      return c <= 0;
+    case ExprKind::le:
+      return c < 0;
+    case ExprKind::gt:
+      return c >= 0;
+    case ExprKind::ge:
+      return c > 0;
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+void RangeAnalysis::run(Program& program) {
+  RangeAnalysis analysis(program);
+  for (const auto& block : program.blocks) {
+    // Nothing is known on entry, not even about the block's own variables
+    Facts facts;
+    analysis.statement(block.body, facts);
+  }
+
+  if (Stats::enabled()) {
+    Stats::count("unchecked divisions",
+                 std::count_if(program.exprs.begin(), program.exprs.end(),
+                               [](const Expr& expr) {
+                                 return expr.kind == ExprKind::div_nonzero;
+                               }));
+  }
+}
+
+void RangeAnalysis::statement(Index index, Facts& facts) {
+  const auto& stmt = program_.stmts[index];
+  switch (stmt.kind) {
+    case StmtKind::empty:
+      break;
+    case StmtKind::assignment: {
+      if (stmt.index != kNone) {
+        // Elements aren't tracked
+        expression(stmt.index, facts);
+        expression(stmt.expr, facts);
+        break;
+      }
+      expression(stmt.expr, facts);
+      auto known = nonzero(stmt.expr, facts);
+      erase(facts, stmt.target);
+      if (known) {
+        insert(facts, stmt.target);
+      }
+      break;
+    }
+    case StmtKind::call:
+      kill_call(stmt.target, facts);
+      break;
+    case StmtKind::statements:
+      for (auto i = 0u; i < stmt.count; i++) {
+        statement(program_.lists[stmt.first + i], facts);
+      }
+      break;
+    case StmtKind::if_: {
+      expression(stmt.expr, facts);
+      Facts then = facts;
+      assume(stmt.expr, true, then);
+      statement(stmt.body, then);
+
+      // Known after the statement when known on both paths
+      assume(stmt.expr, false, facts);
+      Facts both;
+      std::set_intersection(facts.begin(), facts.end(), then.begin(),
+                            then.end(), std::back_inserter(both));
+      facts.swap(both);
+      break;
+    }
+    case StmtKind::while_: {
+      // Only what the body never changes holds on every iteration
+      kill(stmt.body, facts);
+      expression(stmt.expr, facts);
+      Facts body = facts;
+      assume(stmt.expr, true, body);
+      statement(stmt.body, body);
+      assume(stmt.expr, false, facts);
+      break;
+    }
+    case StmtKind::out:
+      expression(stmt.expr, facts);
+      break;
+    case StmtKind::in:
+      if (stmt.index != kNone) {
+        expression(stmt.index, facts);
+      }
+      erase(facts, stmt.target);
+      break;
+  }
+}
+
+void RangeAnalysis::expression(Index index, const Facts& facts) {
+  auto& expr = program_.exprs[index];
+  switch (expr.kind) {
+    case ExprKind::number:
+    case ExprKind::variable:
+      break;
+    case ExprKind::element:
+    case ExprKind::neg:
+    case ExprKind::odd:
+      expression(expr.lhs, facts);
+      break;
+    default:
+      expression(expr.lhs, facts);
+      expression(expr.rhs, facts);
+      if (expr.kind == ExprKind::div && nonzero(expr.rhs, facts)) {
+        expr.kind = ExprKind::div_nonzero;
+      }
+      break;
+  }
+}
+
+bool RangeAnalysis::nonzero(Index index, const Facts& facts) const {
+  const auto& expr = program_.exprs[index];
+  switch (expr.kind) {
+    case ExprKind::number:
+      return expr.value != 0;
+    case ExprKind::variable:
+      return contains(facts, expr.decl);
+    case ExprKind::neg:
+      return nonzero(expr.lhs, facts);
+    default:
+      // Products and sums of non-zero values wrap around to zero
+      return false;
+  }
+}
+
+void RangeAnalysis::assume(Index cond, bool holds, Facts& facts) const {
+  const auto& expr = program_.exprs[cond];
+  if (expr.kind == ExprKind::odd) {
+    const auto& operand = program_.exprs[expr.lhs];
+    if (holds && operand.kind == ExprKind::variable) {
+      insert(facts, operand.decl);
+    }
+    return;
+  }
+
+  // A variable compared with a constant
+  const auto* lhs = &program_.exprs[expr.lhs];
+  const auto* rhs = &program_.exprs[expr.rhs];
+  auto kind = expr.kind;
+  if (lhs->kind == ExprKind::number && rhs->kind == ExprKind::variable) {
+    std::swap(lhs, rhs);
+    kind = mirror(kind);
+  }
+  if (lhs->kind != ExprKind::variable || rhs->kind != ExprKind::number) {
+    return;
+  }
+  if (excludes_zero(holds ? kind : negate(kind), rhs->value)) {
+    insert(facts, lhs->decl);
+  }
+}
+
+void RangeAnalysis::kill(Index index, Facts& facts) const {
+  const auto& stmt = program_.stmts[index];
+  switch (stmt.kind) {
+    case StmtKind::assignment:
+    case StmtKind::in:
+      erase(facts, stmt.target);
+      break;
+    case StmtKind::call:
+      kill_call(stmt.target, facts);
+      break;
+    case StmtKind::statements:
+      for (auto i = 0u; i < stmt.count; i++) {
+        kill(program_.lists[stmt.first + i], facts);
+      }
+      break;
+    case StmtKind::if_:
+    case StmtKind::while_:
+      kill(stmt.body, facts);
+      break;
+    default:
+      break;
+  }
+}
+
+void RangeAnalysis::kill_call(Index block, Facts& facts) const {
+  // A procedure can only write the variables visible here through its free
+  // variables (which include those of the procedures it calls); its own
+  // variables and those of enclosing procedures it re-enters are new
+  const auto& free = program_.blocks[block].free;
+  for (auto i = 0u; i < free.count; i++) {
+    erase(facts, program_.list_of(free)[i]);
+  }
+}
+
+}  // namespace pl0
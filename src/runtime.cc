@@ -0,0 +1,543 @@
+#include "runtime.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+// Output is collected here and written with write(2) when it fills up, at
+// the end of `main` and before an error message is printed. Each thread
+// has its own buffer, so programs of a batch can run side by side.
+constexpr size_t kOutBufferSize = 1 << 16;
+// Longest line: "-2147483648\n"
+constexpr size_t kMaxNumberLength = 12;
+
+thread_local char out_buffer[kOutBufferSize];
+thread_local size_t out_size = 0;
+thread_local std::string* out_capture = nullptr;
+
+const char kDigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+void write_all(const char* data, size_t size) {
+  if (out_capture) {
+    out_capture->append(data, size);
+    return;
+  }
+  while (size > 0) {
+    auto n = ::write(STDOUT_FILENO, data, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    data += n;
+    size -= static_cast<size_t>(n);
+  }
+}
+
+// Input is mapped in one piece when stdin is a regular file, otherwise it
+// is read in large blocks (per thread, like the output).
+constexpr size_t kInBufferSize = 1 << 16;
+
+thread_local char in_buffer[kInBufferSize];
+thread_local const char* in_cur = nullptr;
+thread_local const char* in_end = nullptr;
+thread_local bool in_eof = false;
+thread_local bool in_initialized = false;
+
+void in_init() {
+  in_initialized = true;
+
+  struct stat st;
+  if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    auto offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    if (offset >= 0 && offset < st.st_size) {
+      auto size = static_cast<size_t>(st.st_size);
+      auto p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+      if (p != MAP_FAILED) {
+        madvise(p, size, MADV_SEQUENTIAL);
+        in_cur = static_cast<const char*>(p) + offset;
+        in_end = static_cast<const char*>(p) + size;
+        in_eof = true;
+        return;
+      }
+    }
+  }
+
+  in_cur = in_end = in_buffer;
+}
+
+// Refill the buffer; false at end of input
+bool in_fill() {
+  if (in_eof) {
+    return false;
+  }
+  while (true) {
+    auto n = ::read(STDIN_FILENO, in_buffer, kInBufferSize);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      in_eof = true;
+      return false;
+    }
+    in_cur = in_buffer;
+    in_end = in_buffer + n;
+    return true;
+  }
+}
+
+inline int in_peek() {
+  if (in_cur == in_end && !in_fill()) {
+    return -1;
+  }
+  return static_cast<unsigned char>(*in_cur);
+}
+
+inline bool is_space(int c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+thread_local bool fast_fail = false;
+
+// Memo tables: 4-way set associative, LRU within a set. A table that
+// hits less than 1 in kMemoMinHitRate lookups after kMemoTrial misses stops
+// caching, since a lookup costs more than most procedures it's used for.
+constexpr uint32_t kMemoWays = 4;
+constexpr uint64_t kMemoTrial = 1 << 16;
+constexpr uint64_t kMemoMinHitRate = 16;
+
+struct MemoTable {
+  std::string name;  // outlives the JIT compiled code
+  uint32_t inputs;
+  uint32_t outputs;
+  uint32_t mask;  // sets - 1
+  uint64_t clock = 0;
+  std::vector<uint64_t> used;  // last use of each entry (0: empty)
+  std::vector<int32_t> data;   // inputs then outputs of each entry
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  uint64_t bypassed = 0;
+  bool off = false;
+
+  int32_t* entry(uint32_t i) {
+    return data.data() + static_cast<size_t>(i) * (inputs + outputs);
+  }
+
+  // First entry of the set of a key
+  uint32_t set(const int32_t* key) const {
+    uint32_t h = 2166136261u;
+    for (auto i = 0u; i < inputs; i++) {
+      h = (h ^ static_cast<uint32_t>(key[i])) * 16777619u;
+    }
+    return ((h ^ (h >> 15)) & mask) * kMemoWays;
+  }
+
+  bool matches(uint32_t i, const int32_t* key) {
+    return used[i] && !std::memcmp(entry(i), key, inputs * sizeof(int32_t));
+  }
+};
+
+std::vector<std::unique_ptr<MemoTable>> memo_tables;
+
+// Counters registered by `__pl0_start` (--profile). They live in the
+// generated code until `__pl0_profile_save` copies them; names are copied
+// right away.
+struct ProfileSite {
+  std::string name;
+  int32_t line;
+  int32_t column;
+  const uint64_t* live;  // null once saved
+  uint64_t saved[4];
+
+  const uint64_t* counters() const { return live ? live : saved; }
+};
+
+// Procedure counters
+enum { kCalls, kActive, kCycles, kSelfCycles };
+
+std::vector<ProfileSite> profile_procs;
+std::vector<ProfileSite> profile_loops;     // iterations, entries
+std::vector<ProfileSite> profile_branches;  // executions, taken
+
+std::string location(const ProfileSite& site) {
+  return std::to_string(site.line) + ":" + std::to_string(site.column);
+}
+
+// Procedures by self cycles, loops by iterations
+void sort_profile() {
+  std::stable_sort(profile_procs.begin(), profile_procs.end(),
+                   [](const ProfileSite& a, const ProfileSite& b) {
+                     return a.counters()[kSelfCycles] >
+                            b.counters()[kSelfCycles];
+                   });
+  std::stable_sort(profile_loops.begin(), profile_loops.end(),
+                   [](const ProfileSite& a, const ProfileSite& b) {
+                     return a.counters()[0] > b.counters()[0];
+                   });
+}
+
+[[noreturn]] void fail(const char* msg) {
+  if (fast_fail) {
+    __pl0_error(msg);
+  }
+  throw msg;
+}
+
+}  // namespace
+
+extern "C" {
+
+void __pl0_out(int32_t value) {
+  if (out_size + kMaxNumberLength > kOutBufferSize) {
+    __pl0_flush();
+  }
+
+  // Format right to left, two digits at a time
+  char tmp[kMaxNumberLength];
+  auto end = tmp + sizeof(tmp);
+  auto p = end;
+  *--p = '\n';
+
+  auto u = value < 0 ? 0u - static_cast<uint32_t>(value)
+                     : static_cast<uint32_t>(value);
+  while (u >= 100) {
+    auto i = (u % 100) * 2;
+    u /= 100;
+    *--p = kDigitPairs[i + 1];
+    *--p = kDigitPairs[i];
+  }
+  if (u >= 10) {
+    auto i = u * 2;
+    *--p = kDigitPairs[i + 1];
+    *--p = kDigitPairs[i];
+  } else {
+    *--p = static_cast<char>('0' + u);
+  }
+  if (value < 0) {
+    *--p = '-';
+  }
+
+  auto len = static_cast<size_t>(end - p);
+  std::memcpy(out_buffer + out_size, p, len);
+  out_size += len;
+}
+
+void __pl0_flush() {
+  write_all(out_buffer, out_size);
+  out_size = 0;
+}
+
+void* __pl0_memo_table(const char* name, int32_t inputs, int32_t outputs,
+                       int32_t size) {
+  auto table = std::make_unique<MemoTable>();
+  table->name = name;
+  table->inputs = static_cast<uint32_t>(inputs);
+  table->outputs = static_cast<uint32_t>(outputs);
+
+  uint64_t sets = 1;
+  while (sets * kMemoWays < static_cast<uint32_t>(size)) {
+    sets *= 2;
+  }
+  table->mask = static_cast<uint32_t>(sets - 1);
+  table->used.resize(sets * kMemoWays);
+  table->data.resize(sets * kMemoWays * (table->inputs + table->outputs));
+
+  memo_tables.push_back(std::move(table));
+  return memo_tables.back().get();
+}
+
+int32_t __pl0_memo_lookup(void* table, const int32_t* key, int32_t* values) {
+  auto t = static_cast<MemoTable*>(table);
+  if (t->off) {
+    t->bypassed++;
+    return 0;
+  }
+
+  auto first = t->set(key);
+  for (auto i = first; i < first + kMemoWays; i++) {
+    if (t->matches(i, key)) {
+      t->used[i] = ++t->clock;
+      t->hits++;
+      std::memcpy(values, t->entry(i) + t->inputs,
+                  t->outputs * sizeof(int32_t));
+      return 1;
+    }
+  }
+  t->misses++;
+  if (t->misses >= kMemoTrial && t->hits * kMemoMinHitRate < t->misses) {
+    t->off = true;
+  }
+  return 0;
+}
+
+void __pl0_memo_store(void* table, const int32_t* key, const int32_t* values) {
+  auto t = static_cast<MemoTable*>(table);
+  if (t->off) {
+    return;
+  }
+  auto first = t->set(key);
+
+  // The same key (stored by a nested call), else the least recently used
+  auto victim = first;
+  for (auto i = first; i < first + kMemoWays; i++) {
+    if (t->matches(i, key)) {
+      victim = i;
+      break;
+    }
+    if (t->used[i] < t->used[victim]) {
+      victim = i;
+    }
+  }
+  if (t->used[victim] && !t->matches(victim, key)) {
+    t->evictions++;
+  }
+
+  t->used[victim] = ++t->clock;
+  std::memcpy(t->entry(victim), key, t->inputs * sizeof(int32_t));
+  std::memcpy(t->entry(victim) + t->inputs, values,
+              t->outputs * sizeof(int32_t));
+}
+
+void __pl0_memo_report() {
+  std::fprintf(stderr, "%-24s %12s %12s %9s %12s %12s %12s\n", "memo",
+               "calls", "hits", "hit rate", "entries", "evictions",
+               "bypassed");
+  for (const auto& t : memo_tables) {
+    auto calls = t->hits + t->misses + t->bypassed;
+    size_t entries = 0;
+    for (auto used : t->used) {
+      entries += used != 0;
+    }
+    std::fprintf(stderr, "%-24s %12llu %12llu %8.1f%% %12zu %12llu %12llu\n",
+                 t->name.c_str(), static_cast<unsigned long long>(calls),
+                 static_cast<unsigned long long>(t->hits),
+                 calls ? 100.0 * t->hits / calls : 0.0, entries,
+                 static_cast<unsigned long long>(t->evictions),
+                 static_cast<unsigned long long>(t->bypassed));
+  }
+}
+
+void __pl0_profile_proc(const char* name, int32_t line, int32_t column,
+                        uint64_t* counters) {
+  profile_procs.push_back({name, line, column, counters, {}});
+}
+
+void __pl0_profile_loop(const char* proc, int32_t line, int32_t column,
+                        uint64_t* counters) {
+  profile_loops.push_back({proc, line, column, counters, {}});
+}
+
+void __pl0_profile_branch(const char* proc, int32_t line, int32_t column,
+                          uint64_t* counters) {
+  profile_branches.push_back({proc, line, column, counters, {}});
+}
+
+void __pl0_profile_save() {
+  auto save = [](std::vector<ProfileSite>& sites, size_t counters) {
+    for (auto& site : sites) {
+      if (site.live) {
+        std::memcpy(site.saved, site.live, counters * sizeof(uint64_t));
+        site.live = nullptr;
+      }
+    }
+  };
+  save(profile_procs, 4);
+  save(profile_loops, 2);
+  save(profile_branches, 2);
+}
+
+void __pl0_profile_report() {
+  sort_profile();
+
+  // The main block's cycles cover the whole run
+  uint64_t total = 0;
+  for (const auto& p : profile_procs) {
+    total += p.counters()[kSelfCycles];
+  }
+  auto percent = [&](uint64_t cycles) {
+    return total ? 100.0 * cycles / total : 0.0;
+  };
+
+  std::fprintf(stderr, "%-24s %-10s %12s %16s %7s %16s %7s\n", "procedure",
+               "location", "calls", "cycles", "%", "self cycles", "%");
+  for (const auto& p : profile_procs) {
+    std::fprintf(stderr, "%-24s %-10s %12llu %16llu %6.1f%% %16llu %6.1f%%\n",
+                 p.name.c_str(), location(p).c_str(),
+                 static_cast<unsigned long long>(p.counters()[kCalls]),
+                 static_cast<unsigned long long>(p.counters()[kCycles]),
+                 percent(p.counters()[kCycles]),
+                 static_cast<unsigned long long>(p.counters()[kSelfCycles]),
+                 percent(p.counters()[kSelfCycles]));
+  }
+  if (!profile_loops.empty()) {
+    std::fprintf(stderr, "%-24s %-10s %12s\n", "loop", "location",
+                 "iterations");
+    for (const auto& l : profile_loops) {
+      std::fprintf(stderr, "%-24s %-10s %12llu\n", l.name.c_str(),
+                   location(l).c_str(),
+                   static_cast<unsigned long long>(l.counters()[0]));
+    }
+  }
+}
+
+int32_t __pl0_profile_write(const char* path) {
+  auto file = std::fopen(path, "w");
+  if (!file) {
+    return 0;
+  }
+  sort_profile();
+
+  // Identifiers need no escaping
+  std::fprintf(file, "{\"procedures\": [");
+  for (size_t i = 0; i < profile_procs.size(); i++) {
+    const auto& p = profile_procs[i];
+    std::fprintf(file,
+                 "%s\n  {\"name\": \"%s\", \"line\": %d, \"column\": %d, "
+                 "\"calls\": %llu, \"cycles\": %llu, \"self_cycles\": %llu}",
+                 i ? "," : "", p.name.c_str(), p.line, p.column,
+                 static_cast<unsigned long long>(p.counters()[kCalls]),
+                 static_cast<unsigned long long>(p.counters()[kCycles]),
+                 static_cast<unsigned long long>(p.counters()[kSelfCycles]));
+  }
+  std::fprintf(file, "\n], \"loops\": [");
+  for (size_t i = 0; i < profile_loops.size(); i++) {
+    const auto& l = profile_loops[i];
+    std::fprintf(file,
+                 "%s\n  {\"procedure\": \"%s\", \"line\": %d, "
+                 "\"column\": %d, \"iterations\": %llu}",
+                 i ? "," : "", l.name.c_str(), l.line, l.column,
+                 static_cast<unsigned long long>(l.counters()[0]));
+  }
+  std::fprintf(file, "\n]}\n");
+  return std::fclose(file) == 0;
+}
+
+int32_t __pl0_profile_write_counts(const char* path) {
+  auto file = std::fopen(path, "w");
+  if (!file) {
+    return 0;
+  }
+
+  // Statements are located relative to their procedure
+  auto line = [](const ProfileSite& site) {
+    for (const auto& p : profile_procs) {
+      if (p.name == site.name) {
+        return site.line - p.line;
+      }
+    }
+    return site.line;
+  };
+
+  std::fprintf(file, "pl0-profile 1\n");
+  for (const auto& p : profile_procs) {
+    std::fprintf(file, "proc %s %llu\n", p.name.c_str(),
+                 static_cast<unsigned long long>(p.counters()[kCalls]));
+  }
+  for (const auto& l : profile_loops) {
+    std::fprintf(file, "loop %s %d:%d %llu %llu\n", l.name.c_str(), line(l),
+                 l.column, static_cast<unsigned long long>(l.counters()[1]),
+                 static_cast<unsigned long long>(l.counters()[0]));
+  }
+  for (const auto& b : profile_branches) {
+    std::fprintf(file, "if %s %d:%d %llu %llu\n", b.name.c_str(), line(b),
+                 b.column, static_cast<unsigned long long>(b.counters()[0]),
+                 static_cast<unsigned long long>(b.counters()[1]));
+  }
+  return std::fclose(file) == 0;
+}
+
+void __pl0_print_error(const char* msg) {
+  __pl0_flush();
+  write_all(msg, std::strlen(msg));
+  write_all("\n", 1);
+}
+
+void __pl0_fast_fail() { fast_fail = true; }
+
+void __pl0_error(const char* msg) {
+  __pl0_print_error(msg);
+  // The JIT that runs the program is still on the stack, so skip the static
+  // destructors
+  _exit(0);
+}
+
+int32_t __pl0_in() {
+  if (!in_initialized) {
+    in_init();
+  }
+
+  auto c = in_peek();
+  while (is_space(c)) {
+    in_cur++;
+    c = in_peek();
+  }
+  if (c < 0) {
+    fail("end of input");
+  }
+
+  auto negative = c == '-';
+  if (c == '-' || c == '+') {
+    in_cur++;
+    c = in_peek();
+  }
+  if (c < '0' || c > '9') {
+    fail("invalid input");
+  }
+
+  uint32_t u = 0;
+  while (c >= '0' && c <= '9') {
+    // Fast path over the digits available in the buffer
+    auto p = in_cur;
+    while (p != in_end && static_cast<unsigned>(*p - '0') < 10) {
+      u = u * 10 + static_cast<uint32_t>(*p - '0');
+      p++;
+    }
+    in_cur = p;
+    c = in_peek();
+  }
+  if (c >= 0 && !is_space(c)) {
+    fail("invalid input");
+  }
+
+  return static_cast<int32_t>(negative ? 0u - u : u);
+}
+
+}
+
+namespace pl0 {
+
+void capture_output(std::string* out) {
+  out_capture = out;
+  out_size = 0;
+}
+
+void set_input(std::string_view data) {
+  in_cur = data.data();
+  in_end = data.data() + data.size();
+  in_eof = true;
+  in_initialized = true;
+}
+
+}  // namespace pl0
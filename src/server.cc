@@ -0,0 +1,200 @@
+#include "server.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace pl0 {
+
+namespace {
+
+// Requests larger than this are rejected
+constexpr uint32_t kMaxPayload = 1 << 20;
+
+// SIGCHLD wakes up the accept loop through this pipe
+int sigchld_pipe[2] = {-1, -1};
+
+void on_sigchld(int) {
+  auto saved = errno;
+  char c = 0;
+  if (::write(sigchld_pipe[1], &c, 1) < 0) {
+    // The pipe is full, so the loop wakes up anyway
+  }
+  errno = saved;
+}
+
+bool read_all(int fd, char* data, size_t size) {
+  while (size > 0) {
+    auto n = ::read(fd, data, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+// Runs in the forked child: take over the client's descriptors and working
+// directory, then run the command line
+[[noreturn]] void handle(
+    int conn, const std::function<int(int argc, const char** argv)>& run) {
+  uint32_t length = 0;
+  iovec iov{&length, sizeof(length)};
+  int fds[3];
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(fds))];
+  msghdr msg{};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  auto n = recvmsg(conn, &msg, 0);
+  auto cmsg = CMSG_FIRSTHDR(&msg);
+  if (n != sizeof(length) || !cmsg || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(fds)) || length > kMaxPayload) {
+    std::cerr << "invalid request." << std::endl;
+    _exit(1);
+  }
+  std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+  std::vector<char> payload(length);
+  if (!read_all(conn, payload.data(), payload.size()) || payload.empty() ||
+      payload.back() != '\0') {
+    std::cerr << "invalid request." << std::endl;
+    _exit(1);
+  }
+  close(conn);
+
+  // Working directory, then `pl0` arguments
+  std::vector<const char*> args = {"pl0"};
+  for (size_t i = std::strlen(payload.data()) + 1; i < payload.size();
+       i += std::strlen(&payload[i]) + 1) {
+    args.push_back(&payload[i]);
+  }
+  args.push_back(nullptr);
+
+  for (auto i = 0; i < 3; i++) {
+    dup2(fds[i], i);
+    if (fds[i] > 2) {
+      close(fds[i]);
+    }
+  }
+  if (chdir(payload.data()) < 0) {
+    std::cerr << "can't change to the directory '" << payload.data() << "'."
+              << std::endl;
+    std::exit(-1);
+  }
+
+  std::exit(run(static_cast<int>(args.size() - 1), args.data()));
+}
+
+}  // namespace
+
+int serve(const std::string& path,
+          const std::function<int(int argc, const char** argv)>& run) {
+  sockaddr_un addr{};
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    std::cerr << "the socket path is too long." << std::endl;
+    return -1;
+  }
+  std::strcpy(addr.sun_path, path.c_str());
+
+  auto listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(path.c_str());
+  if (listener < 0 ||
+      bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      listen(listener, SOMAXCONN) < 0) {
+    std::cerr << "can't listen on '" << path << "': " << std::strerror(errno)
+              << std::endl;
+    return -1;
+  }
+
+  if (pipe(sigchld_pipe) < 0) {
+    std::cerr << "can't create a pipe." << std::endl;
+    return -1;
+  }
+  for (auto fd : sigchld_pipe) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+
+  struct sigaction sa {};
+  sa.sa_handler = on_sigchld;
+  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigaction(SIGCHLD, &sa, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  // Connection of each running request
+  std::map<pid_t, int> requests;
+
+  for (;;) {
+    pollfd fds[] = {{listener, POLLIN, 0}, {sigchld_pipe[0], POLLIN, 0}};
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "poll failed: " << std::strerror(errno) << std::endl;
+      return -1;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      char buf[64];
+      while (::read(sigchld_pipe[0], buf, sizeof(buf)) > 0) {
+      }
+
+      // Reply with the exit status of finished requests
+      int status;
+      pid_t pid;
+      while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        auto it = requests.find(pid);
+        if (it == requests.end()) {
+          continue;
+        }
+        int32_t code = WIFEXITED(status) ? WEXITSTATUS(status)
+                                         : 128 + WTERMSIG(status);
+        send(it->second, &code, sizeof(code), MSG_NOSIGNAL);
+        close(it->second);
+        requests.erase(it);
+      }
+    }
+
+    if (fds[0].revents & POLLIN) {
+      auto conn = accept(listener, nullptr, nullptr);
+      if (conn < 0) {
+        continue;
+      }
+
+      auto pid = fork();
+      if (pid == 0) {
+        close(listener);
+        close(sigchld_pipe[0]);
+        close(sigchld_pipe[1]);
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+        handle(conn, run);
+      }
+      if (pid < 0) {
+        std::cerr << "fork failed: " << std::strerror(errno) << std::endl;
+        close(conn);
+        continue;
+      }
+      requests[pid] = conn;
+    }
+  }
+}
+
+}  // namespace pl0
@@ -0,0 +1,212 @@
+#include "stats.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <mutex>
+#include <string_view>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <vector>
+
+namespace pl0 {
+
+namespace {
+
+struct Event {
+  const char* name;
+  int thread;
+  int depth;
+  double start;  // microseconds since `enable`
+  double wall;
+  double cpu;
+  long rss;       // RSS in KiB when the phase ended
+  long peak_rss;  // peak RSS in KiB when the phase ended
+};
+
+struct Counter {
+  const char* name;
+  uint64_t value;
+};
+
+bool recording = false;
+std::chrono::steady_clock::time_point origin;
+
+// Compile threads record phases too
+std::mutex mutex;
+std::vector<Event> events;
+std::vector<Counter> counters;
+std::atomic<int> threads{0};
+thread_local int thread = ++threads;
+thread_local int depth = 0;
+
+double now() {
+  return std::chrono::duration<double, std::micro>(
+             std::chrono::steady_clock::now() - origin)
+      .count();
+}
+
+double cpu_time() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+long peak_rss() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+// Resident pages right now (0 where /proc isn't available)
+long current_rss() {
+  long size = 0, resident = 0;
+  if (auto file = std::fopen("/proc/self/statm", "r")) {
+    if (std::fscanf(file, "%ld %ld", &size, &resident) != 2) {
+      resident = 0;
+    }
+    std::fclose(file);
+  }
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+}  // namespace
+
+void Stats::enable() {
+  recording = true;
+  origin = std::chrono::steady_clock::now();
+}
+
+bool Stats::enabled() { return recording; }
+
+void Stats::count(const char* name, uint64_t value) {
+  if (!recording) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto& counter : counters) {
+    if (std::string_view(counter.name) == name) {
+      counter.value += value;
+      return;
+    }
+  }
+  counters.push_back({name, value});
+}
+
+Stats::Phase::Phase(const char* name) {
+  if (!recording) {
+    return;
+  }
+  // Wall and CPU (thread) time hold the start until the phase ends
+  Event event{name, thread, depth++, now(), 0, cpu_time(), 0, 0};
+  std::lock_guard<std::mutex> lock(mutex);
+  index_ = events.size();
+  events.push_back(event);
+}
+
+Stats::Phase::~Phase() {
+  if (!recording) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  auto& event = events[index_];
+  event.wall = now() - event.start;
+  event.cpu = cpu_time() - event.cpu;
+  event.rss = current_rss();
+  event.peak_rss = peak_rss();
+  depth--;
+}
+
+void Stats::print(std::ostream& os) {
+  // Repeated phases (e.g. per procedure codegen) are summed
+  struct Row {
+    const char* name;
+    int depth;
+    size_t count;
+    double wall;
+    double cpu;
+    long rss;
+    long peak_rss;
+  };
+  std::vector<Row> rows;
+  std::lock_guard<std::mutex> lock(mutex);
+  for (const auto& event : events) {
+    auto it = rows.begin();
+    while (it != rows.end() && !(it->depth == event.depth &&
+                                 std::string_view(it->name) == event.name)) {
+      ++it;
+    }
+    if (it == rows.end()) {
+      rows.push_back({event.name, event.depth, 0, 0, 0, 0, 0});
+      it = rows.end() - 1;
+    }
+    it->count++;
+    it->wall += event.wall;
+    it->cpu += event.cpu;
+    it->rss = std::max(it->rss, event.rss);
+    it->peak_rss = std::max(it->peak_rss, event.peak_rss);
+  }
+
+  // RSS is what was resident when the phase ended (after "execute", the
+  // steady state of the running program), peak RSS the most so far
+  char line[128];
+  std::snprintf(line, sizeof(line), "%-24s %6s %12s %12s %10s %14s\n",
+                "phase", "count", "wall ms", "cpu ms", "rss KiB",
+                "peak rss KiB");
+  os << line;
+  for (const auto& row : rows) {
+    auto name = std::string(row.depth * 2, ' ') + row.name;
+    std::snprintf(line, sizeof(line),
+                  "%-24s %6zu %12.3f %12.3f %10ld %14ld\n", name.c_str(),
+                  row.count, row.wall / 1e3, row.cpu / 1e3, row.rss,
+                  row.peak_rss);
+    os << line;
+  }
+  for (const auto& counter : counters) {
+    std::snprintf(line, sizeof(line), "%-24s %20llu\n", counter.name,
+                  static_cast<unsigned long long>(counter.value));
+    os << line;
+  }
+}
+
+bool Stats::write_trace(const std::string& path) {
+  std::ofstream ofs(path);
+  if (!ofs) {
+    return false;
+  }
+
+  // Complete ("X") events for phases, one track per thread, and counter
+  // ("C") events at the end
+  std::lock_guard<std::mutex> lock(mutex);
+  char line[256];
+  ofs << "{\"traceEvents\":[\n";
+  auto end = 0.0;
+  auto first = true;
+  for (const auto& event : events) {
+    std::snprintf(line, sizeof(line),
+                  "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                  "\"ts\":%.3f,\"dur\":%.3f,"
+                  "\"args\":{\"cpu_us\":%.3f,\"rss_kib\":%ld,"
+                  "\"peak_rss_kib\":%ld}}",
+                  first ? "" : ",\n", event.name, event.thread, event.start,
+                  event.wall, event.cpu, event.rss, event.peak_rss);
+    ofs << line;
+    end = std::max(end, event.start + event.wall);
+    first = false;
+  }
+  for (const auto& counter : counters) {
+    std::snprintf(line, sizeof(line),
+                  "%s{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,"
+                  "\"args\":{\"value\":%llu}}",
+                  first ? "" : ",\n", counter.name, end,
+                  static_cast<unsigned long long>(counter.value));
+    ofs << line;
+    first = false;
+  }
+  ofs << "\n]}\n";
+  return static_cast<bool>(ofs);
+}
+
+}  // namespace pl0
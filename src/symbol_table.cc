@@ -1,128 +1,343 @@
 #include "symbol_table.h"
+#include "stats.h"
+#include <cstdint>
 
 namespace pl0 {
 
-using namespace peg::udl;
+using namespace ir;
 
-void SymbolTableBuilder::build_on_ast(const std::shared_ptr<AstPL0> ast,
-                                     std::shared_ptr<SymbolScope> scope) {
-  switch (ast->tag) {
-    case "block"_:
-      block(ast, scope);
-      break;
-    case "assignment"_:
-      assignment(ast, scope);
-      break;
-    case "call"_:
-      call(ast, scope);
-      break;
-    case "ident"_:
-      ident(ast, scope);
-      break;
-    default:
-      for (auto node : ast->nodes) {
-        build_on_ast(node, scope);
+namespace {
+
+// Value of a binary operation or comparison of two numbers, computed the way
+// the generated code does (wrapping around). Divisions that fail or
+// overflow at run time are left to run.
+bool evaluate(ExprKind kind, int32_t lhs, int32_t rhs, int32_t& value) {
+  auto l = static_cast<uint32_t>(lhs);
+  auto r = static_cast<uint32_t>(rhs);
+  switch (kind) {
+    case ExprKind::add:
+      value = static_cast<int32_t>(l + r);
+      return true;
+    case ExprKind::sub:
+      value = static_cast<int32_t>(l - r);
+      return true;
+    case ExprKind::mul:
+      value = static_cast<int32_t>(l * r);
+      return true;
+    case ExprKind::div:
+    case ExprKind::div_nonzero:
+      if (rhs == 0 || (lhs == INT32_MIN && rhs == -1)) {
+        return false;
       }
-      break;
+      value = lhs / rhs;
+      return true;
+    case ExprKind::eq:
+      value = lhs == rhs;
+      return true;
+    case ExprKind::ne:
+      value = lhs != rhs;
+      return true;
+    case ExprKind::lt:
+      value = lhs < rhs;
+      return true;
+    case ExprKind::le:
+      value = lhs <= rhs;
+      return true;
+    case ExprKind::gt:
+      value = lhs > rhs;
+      return true;
+    case ExprKind::ge:
+      value = lhs >= rhs;
+      return true;
+    default:
+      return false;
   }
 }
 
-void SymbolTableBuilder::block(const std::shared_ptr<AstPL0> ast,
-                               std::shared_ptr<SymbolScope> outer) {
-  auto scope = std::make_shared<SymbolScope>(outer);
-  const auto& nodes = ast->nodes;
-  constants(nodes[0], scope);
-  variables(nodes[1], scope);
-  procedures(nodes[2], scope);
-  build_on_ast(nodes[3], scope);
-  ast->scope = scope;
+}  // namespace
+
+void SymbolTableBuilder::build(Program& program) {
+  SymbolTableBuilder builder(program);
+  builder.block(0);
+  builder.propagate();
+
+  if (Stats::enabled()) {
+    Stats::count("folded expressions", builder.folded_);
+    Stats::count("removed statements", builder.removed_);
+  }
+
+  for (auto i = 0u; i < program.blocks.size(); i++) {
+    const auto& free = builder.free_[i];
+    program.blocks[i].free = {static_cast<Index>(program.lists.size()),
+                              static_cast<uint32_t>(free.size())};
+    program.lists.insert(program.lists.end(), free.begin(), free.end());
+  }
 }
 
-void SymbolTableBuilder::constants(const std::shared_ptr<AstPL0> ast,
-                                   std::shared_ptr<SymbolScope> scope) {
-  const auto& nodes = ast->nodes;
-  for (auto i = 0u; i < nodes.size(); i += 2) {
-    auto ident = nodes[i + 0]->token;
-    if (scope->has_symbol(ident)) {
-      throw_runtime_error(
-          nodes[i], "'" + std::string(ident) + "' is already defined...");
+SymbolTableBuilder::SymbolTableBuilder(Program& program)
+    : program_(program),
+      values_(program.names.size()),
+      procedures_(program.names.size()),
+      free_(program.blocks.size()) {}
+
+void SymbolTableBuilder::block(Index index) {
+  const auto& block = program_.blocks[index];
+
+  for (auto i = 0u; i < block.consts.count; i++) {
+    declare(block.consts.first + i, true);
+  }
+  for (auto i = 0u; i < block.vars.count; i++) {
+    declare(block.vars.first + i, false);
+  }
+
+  // A procedure is visible in its own body and the rest of the block
+  for (auto i = 0u; i < block.procs.count; i++) {
+    auto inner = program_.list_of(block.procs)[i];
+    auto& decls = procedures_[program_.blocks[inner].name];
+    if (!decls.empty() && decls.back().block == index) {
+      decls.back().target = inner;
+    } else {
+      decls.push_back({index, inner});
     }
-    auto number = nodes[i + 1]->token_to_number<int>();
-    scope->constants.emplace(ident, number);
+    this->block(inner);
   }
-}
 
-void SymbolTableBuilder::variables(const std::shared_ptr<AstPL0> ast,
-                                   std::shared_ptr<SymbolScope> scope) {
-  const auto& nodes = ast->nodes;
-  for (auto i = 0u; i < nodes.size(); i += 1) {
-    auto ident = nodes[i]->token;
-    if (scope->has_symbol(ident)) {
-      throw_runtime_error(
-          nodes[i], "'" + std::string(ident) + "' is already defined...");
+  statement(index, block.body);
+
+  // Leave the scope
+  for (auto i = 0u; i < block.consts.count; i++) {
+    values_[program_.decls_of(block.consts)[i].name].pop_back();
+  }
+  for (auto i = 0u; i < block.vars.count; i++) {
+    values_[program_.decls_of(block.vars)[i].name].pop_back();
+  }
+  for (auto i = 0u; i < block.procs.count; i++) {
+    auto& decls =
+        procedures_[program_.blocks[program_.list_of(block.procs)[i]].name];
+    if (!decls.empty() && decls.back().block == index) {
+      decls.pop_back();
     }
-    scope->variables.emplace(ident);
   }
 }
 
-void SymbolTableBuilder::procedures(const std::shared_ptr<AstPL0> ast,
-                                    std::shared_ptr<SymbolScope> scope) {
-  const auto& nodes = ast->nodes;
-  for (auto i = 0u; i < nodes.size(); i += 2) {
-    auto ident = nodes[i + 0]->token;
-    auto block = nodes[i + 1];
-    scope->procedures[ident] = block;
-    build_on_ast(block, scope);
+void SymbolTableBuilder::declare(Index decl, bool constant) {
+  auto name = program_.decls[decl].name;
+  if (lookup(name)) {
+    throw_runtime_error(program_, program_.decls[decl].loc,
+                        "'" + program_.names[name] + "' is already defined...");
   }
+  values_[name].push_back({decl, constant});
 }
 
-void SymbolTableBuilder::assignment(const std::shared_ptr<AstPL0> ast,
-                                    std::shared_ptr<SymbolScope> scope) {
-  auto ident = ast->nodes[0]->token;
-  if (scope->has_constant(ident)) {
-    throw_runtime_error(ast->nodes[0], "cannot modify constant value '" +
-                                           std::string(ident) + "'...");
-  } else if (!scope->has_variable(ident)) {
-    throw_runtime_error(ast->nodes[0],
-                        "undefined variable '" + std::string(ident) + "'...");
+void SymbolTableBuilder::statement(Index block, Index index) {
+  auto& stmt = program_.stmts[index];
+  switch (stmt.kind) {
+    case StmtKind::empty:
+      break;
+    case StmtKind::assignment:
+    case StmtKind::in: {
+      auto value = lookup(stmt.name);
+      if (value && value->constant) {
+        throw_runtime_error(program_, stmt.loc,
+                            "cannot modify constant value '" +
+                                program_.names[stmt.name] + "'...");
+      } else if (!value) {
+        throw_runtime_error(program_, stmt.loc,
+                            "undefined variable '" +
+                                program_.names[stmt.name] + "'...");
+      }
+      stmt.target = value->decl;
+      indexed(stmt.target, stmt.index != kNone, stmt.loc);
+      if (stmt.index != kNone) {
+        expression(block, stmt.index);
+      }
+      if (stmt.kind == StmtKind::assignment) {
+        expression(block, stmt.expr);
+      }
+      use(block, stmt.target);
+      break;
+    }
+    case StmtKind::call: {
+      const auto& decls = procedures_[stmt.name];
+      if (decls.empty()) {
+        throw_runtime_error(program_, stmt.loc,
+                            "undefined procedure '" +
+                                program_.names[stmt.name] + "'...");
+      }
+      stmt.target = decls.back().target;
+      calls_.push_back({block, stmt.target});
+      break;
+    }
+    case StmtKind::statements:
+      for (auto i = 0u; i < stmt.count; i++) {
+        statement(block, program_.lists[stmt.first + i]);
+      }
+      break;
+    case StmtKind::if_:
+    case StmtKind::while_: {
+      expression(block, stmt.expr);
+      statement(block, stmt.body);
+
+      // Dead branches and loops that never run are still checked above.
+      // A loop whose condition always holds is kept as it is.
+      bool holds;
+      if (!condition(stmt.expr, holds)) {
+        break;
+      }
+      if (!holds) {
+        stmt.kind = StmtKind::empty;
+        removed_++;
+      } else if (stmt.kind == StmtKind::if_) {
+        stmt = program_.stmts[stmt.body];
+        removed_++;
+      }
+      break;
+    }
+    case StmtKind::out:
+      expression(block, stmt.expr);
+      break;
   }
+}
 
-  build_on_ast(ast->nodes[1], scope);
+void SymbolTableBuilder::expression(Index block, Index index) {
+  auto& expr = program_.exprs[index];
+  switch (expr.kind) {
+    case ExprKind::number:
+      break;
+    case ExprKind::variable: {
+      auto value = lookup(expr.name);
+      if (!value) {
+        throw_runtime_error(program_, expr.loc,
+                            "undefined variable '" +
+                                program_.names[expr.name] + "'...");
+      }
+      if (value->constant) {
+        expr.kind = ExprKind::number;
+        expr.value = program_.decls[value->decl].value;
+      } else {
+        expr.decl = value->decl;
+        indexed(expr.decl, false, expr.loc);
+        use(block, expr.decl);
+      }
+      break;
+    }
+    case ExprKind::element: {
+      auto value = lookup(expr.name);
+      if (!value) {
+        throw_runtime_error(program_, expr.loc,
+                            "undefined variable '" +
+                                program_.names[expr.name] + "'...");
+      }
+      if (value->constant) {
+        throw_runtime_error(program_, expr.loc,
+                            "'" + program_.names[expr.name] +
+                                "' isn't an array...");
+      }
+      expr.decl = value->decl;
+      indexed(expr.decl, true, expr.loc);
+      expression(block, expr.lhs);
+      use(block, expr.decl);
+      break;
+    }
+    case ExprKind::neg: {
+      expression(block, expr.lhs);
+      const auto& operand = program_.exprs[expr.lhs];
+      if (operand.kind == ExprKind::number) {
+        expr.value =
+            static_cast<int32_t>(0u - static_cast<uint32_t>(operand.value));
+        expr.kind = ExprKind::number;
+        folded_++;
+      }
+      break;
+    }
+    case ExprKind::odd:
+      expression(block, expr.lhs);
+      break;
+    default: {
+      expression(block, expr.lhs);
+      expression(block, expr.rhs);
 
-  if (!scope->has_symbol(ident, false)) {
-    scope->free_variables.emplace(ident);
+      // Conditions stay as they are, `condition` evaluates them
+      const auto& lhs = program_.exprs[expr.lhs];
+      const auto& rhs = program_.exprs[expr.rhs];
+      int32_t value;
+      if (expr.kind < ExprKind::odd && lhs.kind == ExprKind::number &&
+          rhs.kind == ExprKind::number &&
+          evaluate(expr.kind, lhs.value, rhs.value, value)) {
+        expr.kind = ExprKind::number;
+        expr.value = value;
+        folded_++;
+      }
+      break;
+    }
   }
 }
 
-void SymbolTableBuilder::call(const std::shared_ptr<AstPL0> ast,
-                              std::shared_ptr<SymbolScope> scope) {
-  auto ident = ast->nodes[0]->token;
-  if (!scope->has_procedure(ident)) {
-    throw_runtime_error(
-        ast->nodes[0], "undefined procedure '" + std::string(ident) + "'...");
+bool SymbolTableBuilder::condition(Index index, bool& holds) const {
+  const auto& expr = program_.exprs[index];
+  const auto& lhs = program_.exprs[expr.lhs];
+  if (expr.kind == ExprKind::odd) {
+    if (lhs.kind != ExprKind::number) {
+      return false;
+    }
+    // ODD is nonzero in the generated code and the interpreter
+    holds = lhs.value != 0;
+    return true;
   }
+  const auto& rhs = program_.exprs[expr.rhs];
+  int32_t value;
+  if (lhs.kind != ExprKind::number || rhs.kind != ExprKind::number ||
+      !evaluate(expr.kind, lhs.value, rhs.value, value)) {
+    return false;
+  }
+  holds = value;
+  return true;
+}
 
-  auto block = scope->get_procedure(ident);
-  if (block->scope) {
-    for (const auto& free : block->scope->free_variables) {
-      if (!scope->has_symbol(free, false)) {
-        scope->free_variables.emplace(free);
-      }
-    }
+void SymbolTableBuilder::indexed(Index decl, bool index, Location loc) {
+  // Arrays are only used an element at a time
+  const auto& var = program_.decls[decl];
+  if (index && !var.size) {
+    throw_runtime_error(program_, loc,
+                        "'" + program_.names[var.name] +
+                            "' isn't an array...");
+  } else if (!index && var.size) {
+    throw_runtime_error(program_, loc,
+                        "array '" + program_.names[var.name] +
+                            "' needs an index...");
   }
 }
 
-void SymbolTableBuilder::ident(const std::shared_ptr<AstPL0> ast,
-                               std::shared_ptr<SymbolScope> scope) {
-  auto ident = ast->token;
-  if (!scope->has_symbol(ident)) {
-    throw_runtime_error(ast,
-                        "undefined variable '" + std::string(ident) + "'...");
+void SymbolTableBuilder::use(Index block, Index decl) {
+  // Variables declared outside the block are free variables
+  if (program_.decls[decl].block != block) {
+    free_[block].insert(decl);
   }
+}
 
-  if (!scope->has_symbol(ident, false)) {
-    scope->free_variables.emplace(ident);
+void SymbolTableBuilder::propagate() {
+  // The callee's free variables are passed through the caller. Calls to
+  // enclosing procedures (and recursion through them) form cycles, so
+  // repeat until nothing changes; every pass adds at least one variable.
+  for (auto changed = true; changed;) {
+    changed = false;
+    for (auto [caller, callee] : calls_) {
+      if (caller == callee) {
+        continue;
+      }
+      for (auto decl : free_[callee]) {
+        if (program_.decls[decl].block != caller &&
+            free_[caller].insert(decl).second) {
+          changed = true;
+        }
+      }
+    }
   }
 }
 
+const SymbolTableBuilder::Value* SymbolTableBuilder::lookup(Name name) const {
+  const auto& decls = values_[name];
+  return decls.empty() ? nullptr : &decls.back();
+}
+
 }  // namespace pl0
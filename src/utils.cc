@@ -1,5 +1,8 @@
 #include "utils.h"
 #include <sstream>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 namespace pl0 {
 
@@ -10,4 +13,10 @@ std::string format_error_message(const std::string& path, size_t ln, size_t col,
   return ss.str();
 }
 
+void trim_heap() {
+#ifdef __GLIBC__
+  malloc_trim(0);
+#endif
+}
+
 }  // namespace pl0